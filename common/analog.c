@@ -43,6 +43,24 @@ u16 adc_read(Pin p, u32 gain) {
     return adc_sample();
 }
 
+/// Switch the ADC to converting on each START event and signalling RESRDY as an event, for
+/// timer-paced sampling with DMA. The faster prescaler leaves time for several channels per
+/// millisecond.
+void adc_stream_enable(u32 inputctrl) {
+    ADC->CTRLB.reg = ADC_CTRLB_PRESCALER_DIV64;
+    ADC->INPUTCTRL.reg = inputctrl;
+    ADC->EVCTRL.reg = ADC_EVCTRL_STARTEI | ADC_EVCTRL_RESRDYEO;
+    ADC->INTFLAG.reg = ADC_INTFLAG_RESRDY;
+    while(ADC->STATUS.reg & ADC_STATUS_SYNCBUSY);
+}
+
+/// Return the ADC to software-triggered conversions for adc_read
+void adc_stream_disable() {
+    ADC->EVCTRL.reg = 0;
+    ADC->CTRLB.reg = ADC_CTRLB_PRESCALER_DIV512;
+    while(ADC->STATUS.reg & ADC_STATUS_SYNCBUSY);
+}
+
 void dac_init(u8 channel) {
     // hook up clk
     PM->APBCMASK.reg |= PM_APBCMASK_DAC;
@@ -51,18 +69,42 @@ void dac_init(u8 channel) {
     GCLK_CLKCTRL_ID(DAC_GCLK_ID);
 }
 
-void dac_write(Pin p, u16 val) {
+/// Switch the pin to the DAC output and enable the DAC if it is off. The DAC keeps its
+/// configuration between writes, so it is not reset each time.
+void dac_enable(Pin p) {
     // switch dac pinmux. this must be PA02
     pin_analog(p);
 
-    // disable
-    DAC->CTRLA.reg &= ~DAC_CTRLA_ENABLE;
+    if (DAC->CTRLA.reg & DAC_CTRLA_ENABLE) {
+        return;
+    }
 
     // set vcc as reference voltage
     DAC->CTRLB.reg = DAC_CTRLB_EOEN |DAC_CTRLB_REFSEL_AVCC;
 
     // enable
     DAC->CTRLA.reg = DAC_CTRLA_ENABLE;
+    while(DAC->STATUS.reg & DAC_STATUS_SYNCBUSY);
+}
 
+void dac_write(Pin p, u16 val) {
+    dac_enable(p);
     DAC->DATA.reg = val;
 }
+
+/// Switch the DAC to loading DATABUF into DATA on each START event, for timer-paced playback
+/// with DMA
+void dac_stream_enable(Pin p) {
+    dac_enable(p);
+
+    DAC->CTRLA.reg &= ~DAC_CTRLA_ENABLE;
+    while(DAC->STATUS.reg & DAC_STATUS_SYNCBUSY);
+    DAC->EVCTRL.reg = DAC_EVCTRL_STARTEI;
+    DAC->CTRLA.reg = DAC_CTRLA_ENABLE;
+    while(DAC->STATUS.reg & DAC_STATUS_SYNCBUSY);
+}
+
+/// Return the DAC to direct writes of DATA for dac_write. The output holds its last value.
+void dac_stream_disable() {
+    DAC->EVCTRL.reg = 0;
+}
@@ -34,6 +34,23 @@ void dma_start(DmaChan chan) {
     __enable_irq();
 }
 
+// Pauses a channel after the beat in progress
+void dma_suspend(DmaChan chan) {
+    __disable_irq();
+    DMAC->CHID.reg = chan;
+    DMAC->CHCTRLB.bit.CMD = DMAC_CHCTRLB_CMD_SUSPEND_Val;
+    __enable_irq();
+}
+
+// Continues a suspended channel. The suspend flag is cleared as it doesn't raise an interrupt.
+void dma_resume(DmaChan chan) {
+    __disable_irq();
+    DMAC->CHID.reg = chan;
+    DMAC->CHCTRLB.bit.CMD = DMAC_CHCTRLB_CMD_RESUME_Val;
+    DMAC->CHINTFLAG.reg = DMAC_CHINTFLAG_SUSP;
+    __enable_irq();
+}
+
 void dma_enable_interrupt(DmaChan chan) {
     __disable_irq();
     DMAC->CHID.reg = chan;
@@ -45,6 +62,12 @@ u32 dma_remaining(DmaChan chan) {
     return dma_descriptors_wb[chan].BTCNT.reg;
 }
 
+// Returns the address that a channel with an incrementing destination writes next. The write-back
+// descriptor holds the block in progress, so this also identifies the block of a descriptor ring.
+u8* dma_next_dst(DmaChan chan) {
+    return (u8*) dma_descriptors_wb[chan].DSTADDR.reg - dma_descriptors_wb[chan].BTCNT.reg;
+}
+
 const u8 dummy_tx = 0x99;
 void dma_fill_sercom_tx(DmacDescriptor* desc, SercomId id, u8 *src, unsigned size) {
     // doesn't matter if this is SPI.DATA or USART.DATA. both are in the same address
@@ -86,6 +109,71 @@ void dma_sercom_configure_rx(DmaChan chan, SercomId id) {
     DMAC->CHCTRLB.reg = DMAC_CHCTRLB_TRIGACT_BEAT | DMAC_CHCTRLB_TRIGSRC(id*2 + 1);
 }
 
+void dma_adc_configure_result(DmaChan chan) {
+    DMAC->CHID.reg = chan;
+    DMAC->CHCTRLA.reg = DMAC_CHCTRLA_SWRST;
+    DMAC->CHCTRLB.reg = DMAC_CHCTRLB_TRIGACT_BEAT | DMAC_CHCTRLB_TRIGSRC(ADC_DMAC_ID_RESRDY);
+}
+
+// Fills a descriptor that copies count ADC results, interrupting when the block is complete
+void dma_fill_adc_result(DmacDescriptor* desc, u16* dst, unsigned count) {
+    desc->SRCADDR.reg = (unsigned) &ADC->RESULT.reg;
+    desc->DSTADDR.reg = (unsigned) (dst + count);
+    desc->BTCNT.reg = count;
+    desc->BTCTRL.reg = DMAC_BTCTRL_VALID | DMAC_BTCTRL_BEATSIZE_HWORD | DMAC_BTCTRL_DSTINC
+                     | DMAC_BTCTRL_BLOCKACT_INT;
+}
+
+// Configures a channel to write a beat to the DAC each time its data buffer is emptied
+void dma_dac_configure(DmaChan chan) {
+    DMAC->CHID.reg = chan;
+    DMAC->CHCTRLA.reg = DMAC_CHCTRLA_SWRST;
+    DMAC->CHCTRLB.reg = DMAC_CHCTRLB_TRIGACT_BEAT | DMAC_CHCTRLB_TRIGSRC(DAC_DMAC_ID_EMPTY);
+}
+
+// Fills a descriptor that copies count samples to the DAC's data buffer
+void dma_fill_dac(DmacDescriptor* desc, u16* src, unsigned count) {
+    desc->SRCADDR.reg = (unsigned) (src + count);
+    desc->DSTADDR.reg = (unsigned) &DAC->DATABUF.reg;
+    desc->BTCNT.reg = count;
+    desc->BTCTRL.reg = DMAC_BTCTRL_VALID | DMAC_BTCTRL_BEATSIZE_HWORD | DMAC_BTCTRL_SRCINC;
+}
+
+// Configures a channel to transfer a beat on each event from its EVSYS user input. Only
+// channels 0-3 have event inputs.
+void dma_event_configure(DmaChan chan) {
+    DMAC->CHID.reg = chan;
+    DMAC->CHCTRLA.reg = DMAC_CHCTRLA_SWRST;
+    DMAC->CHCTRLB.reg = DMAC_CHCTRLB_TRIGACT_BEAT | DMAC_CHCTRLB_EVIE | DMAC_CHCTRLB_EVACT_TRIG;
+}
+
+// Configures a channel to transfer a beat each time the passed peripheral trigger fires
+void dma_trigger_configure(DmaChan chan, u8 trigsrc) {
+    DMAC->CHID.reg = chan;
+    DMAC->CHCTRLA.reg = DMAC_CHCTRLA_SWRST;
+    DMAC->CHCTRLB.reg = DMAC_CHCTRLB_TRIGACT_BEAT | DMAC_CHCTRLB_TRIGSRC(trigsrc);
+}
+
+// Fills a descriptor that reads a register of size bytes (1, 2 or 4) count times into dst
+void dma_fill_register_read(DmacDescriptor* desc, volatile void* src, u8 size, u8* dst, unsigned count) {
+    desc->SRCADDR.reg = (unsigned) src;
+    desc->DSTADDR.reg = (unsigned) dst + count * size;
+    desc->BTCNT.reg = count;
+    desc->BTCTRL.reg = DMAC_BTCTRL_VALID | DMAC_BTCTRL_BEATSIZE(size / 2) | DMAC_BTCTRL_DSTINC
+                     | DMAC_BTCTRL_BLOCKACT_INT;
+    desc->DESCADDR.reg = 0;
+}
+
+// Fills a descriptor that writes count values of size bytes (1, 2 or 4) from src to a register
+void dma_fill_register_write(DmacDescriptor* desc, volatile void* dst, u8 size, u8* src, unsigned count) {
+    desc->SRCADDR.reg = (unsigned) src + count * size;
+    desc->DSTADDR.reg = (unsigned) dst;
+    desc->BTCNT.reg = count;
+    desc->BTCTRL.reg = DMAC_BTCTRL_VALID | DMAC_BTCTRL_BEATSIZE(size / 2) | DMAC_BTCTRL_SRCINC
+                     | DMAC_BTCTRL_BLOCKACT_INT;
+    desc->DESCADDR.reg = 0;
+}
+
 void dma_link_chain(DmacDescriptor* chain, u32 count) {
     for (u32 i = 0; i<count-1; i++) {
         chain[i].DESCADDR.reg = (unsigned) &chain[i+1];
@@ -96,6 +184,8 @@ void dma_link_chain(DmacDescriptor* chain, u32 count) {
 void dma_start_descriptor(DmaChan chan, DmacDescriptor* chain) {
     dma_abort(chan);
     memcpy(&dma_descriptors[chan], &chain[0], sizeof(DmacDescriptor));
+    // Prime the write-back descriptor so that dma_next_dst is valid before the first beat
+    memcpy(&dma_descriptors_wb[chan], &chain[0], sizeof(DmacDescriptor));
     dma_start(chan);
 }
 
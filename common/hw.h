@@ -171,8 +171,13 @@ inline static void evsys_config(u8 channel, u8 source, u8 user) {
 void adc_init(u8 channel, u8 refctrl);
 u16 adc_sample();
 u16 adc_read(Pin p, u32 gain);
+void adc_stream_enable(u32 inputctrl);
+void adc_stream_disable();
 void dac_init(u8 channel);
+void dac_enable(Pin p);
 void dac_write(Pin p, u16 val);
+void dac_stream_enable(Pin p);
+void dac_stream_disable();
 
 
 // clock.c
@@ -187,6 +192,8 @@ void dma_init();
 void dma_sercom_start_tx(DmaChan chan, SercomId id, u8* src, unsigned size);
 void dma_sercom_start_rx(DmaChan chan, SercomId id, u8* dst, unsigned size);
 void dma_abort(DmaChan chan);
+void dma_suspend(DmaChan chan);
+void dma_resume(DmaChan chan);
 void dma_enable_interrupt(DmaChan chan);
 void dma_fill_sercom_tx(DmacDescriptor* desc, SercomId id, u8 *src, unsigned size);
 void dma_fill_sercom_rx(DmacDescriptor* desc, SercomId id, u8 *dst, unsigned size);
@@ -194,7 +201,16 @@ void dma_sercom_configure_tx(DmaChan chan, SercomId id);
 void dma_sercom_configure_rx(DmaChan chan, SercomId id);
 void dma_link_chain(DmacDescriptor* chain, u32 count);
 void dma_start_descriptor(DmaChan chan, DmacDescriptor* chain);
+void dma_adc_configure_result(DmaChan chan);
+void dma_fill_adc_result(DmacDescriptor* desc, u16* dst, unsigned count);
+void dma_dac_configure(DmaChan chan);
+void dma_fill_dac(DmacDescriptor* desc, u16* src, unsigned count);
+void dma_event_configure(DmaChan chan);
+void dma_trigger_configure(DmaChan chan, u8 trigsrc);
+void dma_fill_register_read(DmacDescriptor* desc, volatile void* src, u8 size, u8* dst, unsigned count);
+void dma_fill_register_write(DmacDescriptor* desc, volatile void* dst, u8 size, u8* src, unsigned count);
 u32 dma_remaining(DmaChan chan);
+u8* dma_next_dst(DmaChan chan);
 
 
 // sercom.c
@@ -249,8 +265,17 @@ void tcc_delay_start(TimerId id, u32 ticks);
 void tcc_delay_disable(TimerId id);
 void tcc_delay_enable(TimerId id);
 
+#define TIMESTAMP_TICKS_PER_MS 48000
+
+void timestamp_init();
+void timestamp_tick();
+u32 timestamp_us();
+
 // PWM
 
+// Number of TCCs, each of which is a PWM bank
+#define PWM_NUM_BANKS 3
+
 void pwm_bank_enable(TimerId id);
 void pwm_bank_reset(TimerId id);
 void pwm_bank_disable(TimerId id);
@@ -1,9 +1,12 @@
 #include "hw.h"
 
-// Variable to store our bank period (in ticks)
-u16 bank_period = 0;
+// Period (in ticks) and prescalar of each TCC, applied when its bank is enabled
+typedef struct PwmBank {
+  u16 period;
+  u8 prescalar;
+} PwmBank;
 
-u8 bank_prescalar = 0;
+PwmBank pwm_banks[PWM_NUM_BANKS];
 
 void pwm_bank_enable(TimerId id) {
   // Disable and reset previous settings
@@ -15,8 +18,11 @@ void pwm_bank_enable(TimerId id) {
   // Put the TCC into PWM wavegen mode
   tcc(id)->WAVE.reg |= TCC_WAVE_WAVEGEN_NPWM;
 
-  // Set a default frequency for this bank
-  pwm_bank_set_period(id, bank_prescalar, bank_period);
+  // Apply the last frequency set for this bank
+  tcc(id)->CTRLA.bit.PRESCALER = pwm_banks[id].prescalar;
+  tcc(id)->CTRLA.bit.PRESCSYNC = TCC_CTRLA_PRESCSYNC_PRESC_Val;
+  tcc(id)->PER.reg = pwm_banks[id].period;
+  while (tcc(id)->SYNCBUSY.reg > 0);
 
   // Enable the TCC
   tcc(id)->CTRLA.reg |= TCC_CTRLA_ENABLE;
@@ -45,33 +51,52 @@ void pwm_bank_reset(TimerId id) {
 }
 
 void pwm_bank_set_period(TimerId id, u8 new_prescalar, u16 new_period) {
-  // Store our new period
-  bank_period = new_period;
-  // Store our new prescalar
-  bank_prescalar = new_prescalar;
+  // Store the new settings of this bank only
+  pwm_banks[id].period = new_period;
+  pwm_banks[id].prescalar = new_prescalar;
+
+  // A disabled bank picks them up when its first duty cycle enables it
+  if (tcc(id)->CTRLA.bit.ENABLE == 0) {
+    return;
+  }
+
+  // The period is double buffered, and the TCC copies it at the end of the current cycle
+  // without stopping the counter
+  if (tcc(id)->CTRLA.bit.PRESCALER == new_prescalar) {
+    tcc(id)->PERB.reg = new_period;
+    return;
+  }
 
-  // Disable the TCC so we can make configuration changes
+  // The prescalar can only be changed while the TCC is disabled. The duty cycles are kept.
   pwm_bank_disable(id);
 
-  // Set the prescalar setting to no division
-  tcc(id)->CTRLA.bit.PRESCALER = bank_prescalar;
+  tcc(id)->CTRLA.bit.PRESCALER = new_prescalar;
 
   // Reset with the prescalar clock, not the generic clock
   tcc(id)->CTRLA.bit.PRESCSYNC = TCC_CTRLA_PRESCSYNC_PRESC_Val;
 
   // Set the top count value (when a match will be hit and the waveform output flipped)
-  tcc(id)->PER.reg = bank_period;
+  tcc(id)->PER.reg = new_period;
+  tcc(id)->COUNT.reg = 0;
 
   // Wait for all the changes to finish loading
   while (tcc(id)->SYNCBUSY.reg > 0);
 
+  tcc(id)->CTRLA.reg |= TCC_CTRLA_ENABLE;
 }
+
 void pwm_set_pin_duty(Pin p, u16 duty_cycle) {
 
   // If the TCC isn't enabled yet
   if (tcc(p.tcc_id)->CTRLA.bit.ENABLE == 0) {
     // Enable it now
     pwm_bank_enable(p.tcc_id);
+
+    // Nothing is being output yet, so the duty cycle can take effect at once
+    tcc(p.tcc_id)->CC[p.cc_chan].reg = duty_cycle;
+  } else {
+    // Load the duty cycle at the end of the current cycle, so the output doesn't glitch
+    tcc(p.tcc_id)->CCB[p.cc_chan].reg = duty_cycle;
   }
 
   // Set the PIN to its alternate mux with is as a TCC output
@@ -80,7 +105,4 @@ void pwm_set_pin_duty(Pin p, u16 duty_cycle) {
   // Set the pin direction to output
   pin_dir(p, true);
 
-  // Set the duty cycle for this channel
-  tcc(p.tcc_id)->CC[p.cc_chan].reg = duty_cycle;
-
 }
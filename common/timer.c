@@ -32,3 +32,29 @@ void tcc_delay_enable(TimerId id) {
     tcc(id)->CTRLA.bit.ENABLE = 1;
     tcc(id)->INTENSET.reg = TCC_INTENSET_OVF;
 }
+
+volatile u32 timestamp_ms;
+
+// counts a millisecond, from the SysTick interrupt
+void timestamp_tick() {
+    timestamp_ms++;
+}
+
+// starts the SysTick counting milliseconds for timestamp_us
+void timestamp_init() {
+    SysTick_Config(TIMESTAMP_TICKS_PER_MS);
+    NVIC_SetPriority(SysTick_IRQn, 0xff);
+}
+
+// microseconds since timestamp_init, wrapping around at 2^32. The caller must be at the same
+// interrupt priority as the SysTick, so that it doesn't count a millisecond while this runs.
+u32 timestamp_us() {
+    u32 ms = timestamp_ms;
+    u32 ticks = SysTick->VAL;
+    if (SCB->ICSR & SCB_ICSR_PENDSTSET_Msk) {
+        // The SysTick wrapped around, and the count hasn't been updated yet
+        ms++;
+        ticks = SysTick->VAL;
+    }
+    return ms * 1000 + (TIMESTAMP_TICKS_PER_MS - 1 - ticks) / (TIMESTAMP_TICKS_PER_MS / 1000);
+}
@@ -9,29 +9,183 @@ typedef enum BridgeState {
 
 BridgeState bridge_state = BRIDGE_STATE_DISABLE;
 
+// Header command bytes. The SoC sends a BRIDGE_CMD_* byte and the coprocessor answers with the
+// BRIDGE_REPLY_* byte of the same header version.
+#define BRIDGE_CMD_V1 0x53
+#define BRIDGE_REPLY_V1 0xCA
+#define BRIDGE_CMD_V2 0x54
+#define BRIDGE_REPLY_V2 0xCB
+
+// Status bit set by either side to advertise support for the v2 header. Both sides switch to v2
+// on the cycle after a v1 header exchange in which each of them saw the other's bit.
+#define BRIDGE_STATUS_V2 0x08
+
+// v1 header: cmd, status, 8-bit size per channel
+#define BRIDGE_CTRL_SIZE_V1 (2 + BRIDGE_NUM_CHAN)
+// v2 header: cmd, status, caps, reserved byte, 16-bit little-endian size per channel
+#define BRIDGE_CTRL_SIZE_V2 (4 + 2*BRIDGE_NUM_CHAN)
+
+// v2 caps bits, advertised by both sides. A mode is used once both sides advertise it.
+
+// Pipelined cycles: every SYNC edge starts a single transfer carrying the data phase for the
+// previously exchanged headers, followed by the exchange of the next headers.
+#define BRIDGE_CAP_PIPELINE 0x01
+
+// Full-duplex data phase: a channel's OUT and IN payloads are clocked at the same time instead of
+// one after the other. Applies to a data phase when both of its headers have the bit set.
+#define BRIDGE_CAP_FULL_DUPLEX 0x02
+
 typedef struct ControlPkt {
     u8 cmd;
     u8 status;
-    u8 size[BRIDGE_NUM_CHAN];
-} __attribute__((packed)) ControlPkt;
+    u8 caps;
+    u16 size[BRIDGE_NUM_CHAN];
+} ControlPkt;
 
 u8 was_open = 0;
 ControlPkt ctrl_rx;
 ControlPkt ctrl_tx;
 
+// In pipelined mode, the header sent at the end of the current cycle, used by the next one
+ControlPkt ctrl_tx_next;
+
+// Header version used for the next control phase
+u8 bridge_version = 1;
+
+// Whether the bridge is running pipelined cycles (BRIDGE_CAP_PIPELINE)
+bool bridge_pipelined = false;
+
+// Wire format of the control packets, decoded into / encoded from ctrl_rx and ctrl_tx
+u8 ctrl_rx_buf[BRIDGE_CTRL_SIZE_V2];
+u8 ctrl_tx_buf[BRIDGE_CTRL_SIZE_V2];
+
 DMA_DESC_ALIGN DmacDescriptor dma_chain_control_rx[2];
 DMA_DESC_ALIGN DmacDescriptor dma_chain_control_tx[2];
 
-DMA_DESC_ALIGN DmacDescriptor dma_chain_data_rx[BRIDGE_NUM_CHAN*2];
-DMA_DESC_ALIGN DmacDescriptor dma_chain_data_tx[BRIDGE_NUM_CHAN*2];
+// Data descriptors, plus the trailing header exchange in pipelined mode
+DMA_DESC_ALIGN DmacDescriptor dma_chain_data_rx[BRIDGE_NUM_CHAN*2 + 2];
+DMA_DESC_ALIGN DmacDescriptor dma_chain_data_tx[BRIDGE_NUM_CHAN*2 + 2];
 
 // These variables store the state configured by bridge_start_{in, out}
 u8* in_chan_ptr[BRIDGE_NUM_CHAN];
-u8 in_chan_size[BRIDGE_NUM_CHAN];
+u16 in_chan_size[BRIDGE_NUM_CHAN];
 
 u8* out_chan_ptr[BRIDGE_NUM_CHAN];
 u8 out_chan_ready;
 
+// The headers of a finished data phase, kept until its completions are processed
+typedef struct BridgeDone {
+    u8 rx_status;
+    u8 tx_status;
+    // Channels whose IN buffer was fully sent by the end of the data phase
+    u8 in_last;
+    u16 rx_size[BRIDGE_NUM_CHAN];
+    u16 tx_size[BRIDGE_NUM_CHAN];
+} BridgeDone;
+
+// In pipelined mode, the SoC can raise the next SYNC before the DMA completion interrupt has run
+// for the previous cycle, so finished data phases are queued for it. While any are waiting, the
+// header advertises no transfers, so only open/close changes can add more.
+#define BRIDGE_DONE_SIZE 4
+BridgeDone bridge_done[BRIDGE_DONE_SIZE];
+u8 bridge_done_head;
+u8 bridge_done_count;
+
+/// Size of the control packet for the current header version
+static inline u32 bridge_ctrl_size() {
+    return bridge_version >= 2 ? BRIDGE_CTRL_SIZE_V2 : BRIDGE_CTRL_SIZE_V1;
+}
+
+/// Set up the DMA chains for the control phase: the SoC sends its header first, then reads ours.
+void bridge_fill_control_chain() {
+    u32 size = bridge_ctrl_size();
+
+    dma_fill_sercom_rx(&dma_chain_control_rx[0], SERCOM_BRIDGE, ctrl_rx_buf, size);
+    dma_fill_sercom_rx(&dma_chain_control_rx[1], SERCOM_BRIDGE, NULL, size);
+    dma_link_chain(dma_chain_control_rx, 2);
+
+    dma_fill_sercom_tx(&dma_chain_control_tx[0], SERCOM_BRIDGE, NULL, size);
+    dma_fill_sercom_tx(&dma_chain_control_tx[1], SERCOM_BRIDGE, ctrl_tx_buf, size);
+    dma_link_chain(dma_chain_control_tx, 2);
+}
+
+/// Fill in the header we send to the SoC from the current bridge state
+void bridge_build_ctrl_tx(ControlPkt* pkt) {
+    u16 max_size = bridge_version >= 2 ? BRIDGE_BUF_SIZE : BRIDGE_BUF_SIZE_V1;
+
+    pkt->cmd = bridge_version >= 2 ? BRIDGE_REPLY_V2 : BRIDGE_REPLY_V1;
+    pkt->status = out_chan_ready | BRIDGE_STATUS_V2;
+    pkt->caps = BRIDGE_CAP_PIPELINE | BRIDGE_CAP_FULL_DUPLEX;
+    for (u8 chan=0; chan<BRIDGE_NUM_CHAN; chan++) {
+        // Frames larger than the header can describe are sent over multiple cycles
+        pkt->size[chan] = in_chan_size[chan] < max_size ? in_chan_size[chan] : max_size;
+    }
+}
+
+/// Serialize a header into ctrl_tx_buf in the current header version
+void bridge_encode_ctrl_tx(ControlPkt* pkt) {
+    ctrl_tx_buf[0] = pkt->cmd;
+    ctrl_tx_buf[1] = pkt->status;
+    if (bridge_version >= 2) {
+        ctrl_tx_buf[2] = pkt->caps;
+        ctrl_tx_buf[3] = 0;
+        for (u8 chan=0; chan<BRIDGE_NUM_CHAN; chan++) {
+            ctrl_tx_buf[4 + chan*2] = pkt->size[chan] & 0xFF;
+            ctrl_tx_buf[5 + chan*2] = pkt->size[chan] >> 8;
+        }
+    } else {
+        for (u8 chan=0; chan<BRIDGE_NUM_CHAN; chan++) {
+            ctrl_tx_buf[2 + chan] = pkt->size[chan];
+        }
+    }
+}
+
+/// Parse ctrl_rx_buf into ctrl_rx. Returns false if the SoC did not send a valid header for the
+/// current version, in which case the bridge falls back to v1 so the SoC can renegotiate.
+bool bridge_decode_ctrl_rx() {
+    u8 cmd = ctrl_rx_buf[0];
+
+    // Zero the command byte so a cycle in which the SoC sent no header is not mistaken for one
+    ctrl_rx_buf[0] = 0x00;
+
+    if (bridge_version >= 2 && cmd == BRIDGE_CMD_V2) {
+        for (u8 chan=0; chan<BRIDGE_NUM_CHAN; chan++) {
+            ctrl_rx.size[chan] = ctrl_rx_buf[4 + chan*2] | (ctrl_rx_buf[5 + chan*2] << 8);
+            if (ctrl_rx.size[chan] > BRIDGE_BUF_SIZE) {
+                bridge_version = 1;
+                bridge_pipelined = false;
+                return false;
+            }
+        }
+        ctrl_rx.caps = ctrl_rx_buf[2];
+    } else if (bridge_version == 1 && cmd == BRIDGE_CMD_V1) {
+        for (u8 chan=0; chan<BRIDGE_NUM_CHAN; chan++) {
+            ctrl_rx.size[chan] = ctrl_rx_buf[2 + chan];
+        }
+        ctrl_rx.caps = 0;
+    } else {
+        bridge_version = 1;
+        bridge_pipelined = false;
+        return false;
+    }
+
+    ctrl_rx.cmd = cmd;
+    ctrl_rx.status = ctrl_rx_buf[1] & ~BRIDGE_STATUS_V2;
+
+    // We always advertise BRIDGE_CAP_PIPELINE, so the SoC decides. The switch takes effect on
+    // the next SYNC edge, after the data phase for this header.
+    if (bridge_version >= 2 && (ctrl_rx.caps & BRIDGE_CAP_PIPELINE)) {
+        bridge_pipelined = true;
+    }
+
+    // Both sides have now seen each other's v2 bit, so the next header is v2
+    if (bridge_version == 1 && (ctrl_rx_buf[1] & BRIDGE_STATUS_V2)) {
+        bridge_version = 2;
+    }
+
+    return true;
+}
+
 void bridge_init() {
     sercom_clock_enable(SERCOM_BRIDGE, GCLK_SYSTEM, 1);
 
@@ -49,14 +203,11 @@ void bridge_init() {
     pin_out(PIN_BRIDGE_IRQ);
 
     dma_sercom_configure_rx(DMA_BRIDGE_RX, SERCOM_BRIDGE);
-    dma_fill_sercom_rx(&dma_chain_control_rx[0], SERCOM_BRIDGE, (u8*)&ctrl_rx, sizeof(ControlPkt));
-    dma_fill_sercom_rx(&dma_chain_control_rx[1], SERCOM_BRIDGE, NULL, sizeof(ControlPkt));
-    dma_link_chain(dma_chain_control_rx, 2);
-
     dma_sercom_configure_tx(DMA_BRIDGE_TX, SERCOM_BRIDGE);
-    dma_fill_sercom_tx(&dma_chain_control_tx[0], SERCOM_BRIDGE, NULL, sizeof(ControlPkt));
-    dma_fill_sercom_tx(&dma_chain_control_tx[1], SERCOM_BRIDGE, (u8*)&ctrl_tx, sizeof(ControlPkt));
-    dma_link_chain(dma_chain_control_tx, 2);
+    bridge_done_count = 0;
+    bridge_version = 1;
+    bridge_pipelined = false;
+    ctrl_rx_buf[0] = 0x00;
 
     pin_mux_eic(PIN_BRIDGE_SYNC);
     eic_config(PIN_BRIDGE_SYNC, EIC_CONFIG_SENSE_BOTH);
@@ -85,20 +236,165 @@ void bridge_disable() {
     bridge_state = BRIDGE_STATE_DISABLE;
 }
 
+/// Build the DMA chains for the data phase described by ctrl_rx and ctrl_tx. Returns the number
+/// of descriptors used.
+u8 bridge_fill_data_chain() {
+    u8 desc = 0;
+    bool full_duplex = ctrl_rx.caps & ctrl_tx.caps & BRIDGE_CAP_FULL_DUPLEX;
+
+    for (u8 chan=0; chan<BRIDGE_NUM_CHAN; chan++) {
+        u16 out_size = (ctrl_tx.status & (1<<chan)) ? ctrl_rx.size[chan] : 0;
+        u16 in_size = (ctrl_rx.status & (1<<chan)) ? ctrl_tx.size[chan] : 0;
+        u8* out_ptr = out_chan_ptr[chan];
+        u8* in_ptr = in_chan_ptr[chan];
+
+        if (out_size > 0) {
+            out_chan_ready &= ~ (1<<chan);
+        }
+
+        if (in_size > in_chan_size[chan]) {
+            // The channel was disabled after its size was advertised. The SoC still clocks the
+            // advertised length, so send filler rather than whatever follows the old buffer.
+            in_ptr = NULL;
+            in_chan_size[chan] = 0;
+        } else if (in_size > 0) {
+            // Any remainder is sent on the next cycle
+            in_chan_ptr[chan] += in_size;
+            in_chan_size[chan] -= in_size;
+        }
+
+        if (full_duplex) {
+            // Clock both directions together, then whatever is left of the longer one
+            u16 both = out_size < in_size ? out_size : in_size;
+            if (both > 0) {
+                dma_fill_sercom_tx(&dma_chain_data_tx[desc], SERCOM_BRIDGE, in_ptr, both);
+                dma_fill_sercom_rx(&dma_chain_data_rx[desc], SERCOM_BRIDGE, out_ptr, both);
+                desc++;
+            }
+            if (out_size > both) {
+                dma_fill_sercom_tx(&dma_chain_data_tx[desc], SERCOM_BRIDGE, NULL, out_size - both);
+                dma_fill_sercom_rx(&dma_chain_data_rx[desc], SERCOM_BRIDGE, out_ptr + both, out_size - both);
+                desc++;
+            } else if (in_size > both) {
+                dma_fill_sercom_tx(&dma_chain_data_tx[desc], SERCOM_BRIDGE, in_ptr + both, in_size - both);
+                dma_fill_sercom_rx(&dma_chain_data_rx[desc], SERCOM_BRIDGE, NULL, in_size - both);
+                desc++;
+            }
+        } else {
+            if (out_size > 0) {
+                dma_fill_sercom_tx(&dma_chain_data_tx[desc], SERCOM_BRIDGE, NULL, out_size);
+                dma_fill_sercom_rx(&dma_chain_data_rx[desc], SERCOM_BRIDGE, out_ptr, out_size);
+                desc++;
+            }
+            if (in_size > 0) {
+                dma_fill_sercom_tx(&dma_chain_data_tx[desc], SERCOM_BRIDGE, in_ptr, in_size);
+                dma_fill_sercom_rx(&dma_chain_data_rx[desc], SERCOM_BRIDGE, NULL, in_size);
+                desc++;
+            }
+        }
+    }
+
+    return desc;
+}
+
+/// Queue the completions of the data phase described by ctrl_rx and ctrl_tx. Must not be
+/// interrupted by a SYNC edge.
+void bridge_queue_done() {
+    if (bridge_done_count == BRIDGE_DONE_SIZE) {
+        invalid();
+    }
+
+    BridgeDone* d = &bridge_done[(bridge_done_head + bridge_done_count) % BRIDGE_DONE_SIZE];
+    d->rx_status = ctrl_rx.status;
+    d->tx_status = ctrl_tx.status;
+    d->in_last = 0;
+    for (u8 chan=0; chan<BRIDGE_NUM_CHAN; chan++) {
+        d->rx_size[chan] = ctrl_rx.size[chan];
+        d->tx_size[chan] = ctrl_tx.size[chan];
+        if (in_chan_size[chan] == 0) {
+            d->in_last |= 1<<chan;
+        }
+    }
+    bridge_done_count++;
+}
+
+/// Handle a SYNC edge in pipelined mode. The transfer that follows carries the data phase for
+/// the headers exchanged at the end of the previous cycle, then the headers for the next cycle.
+void bridge_handle_sync_pipelined() {
+    dma_abort(DMA_BRIDGE_TX);
+    dma_abort(DMA_BRIDGE_RX);
+
+    if (bridge_state == BRIDGE_STATE_DATA) {
+        // The SoC has finished the previous cycle, but its completion interrupt hasn't run yet.
+        // Keep its headers before they are replaced.
+        bridge_queue_done();
+    }
+
+    sercom_spi_slave_init(SERCOM_BRIDGE, BRIDGE_DIPO, BRIDGE_DOPO, 1, 1);
+
+    u8 desc = 0;
+    bool data_phase = false;
+
+    if (ctrl_rx_buf[0] != 0x00) {
+        if (!bridge_decode_ctrl_rx()) {
+            // Back to v1 control/data cycles until the SoC renegotiates
+            bridge_state = BRIDGE_STATE_IDLE;
+            return;
+        }
+        ctrl_tx = ctrl_tx_next;
+        desc = bridge_fill_data_chain();
+        data_phase = desc > 0 || (ctrl_rx.status & 0xF0) != (was_open & 0xF0);
+    }
+    // Otherwise the SoC did not exchange headers in the last cycle (e.g. the first pipelined
+    // cycle), so this one only carries the header exchange.
+
+    // The next header is built after the data chain so it doesn't include in-flight transfers.
+    // As in the control phase, the SoC sends its header first, then reads ours.
+    bridge_build_ctrl_tx(&ctrl_tx_next);
+    if (bridge_done_count > 0) {
+        // Hold off new transfers until the queued completions have been processed
+        ctrl_tx_next.status &= ~((1<<BRIDGE_NUM_CHAN) - 1);
+        memset(ctrl_tx_next.size, 0, sizeof(ctrl_tx_next.size));
+    }
+    bridge_encode_ctrl_tx(&ctrl_tx_next);
+    dma_fill_sercom_tx(&dma_chain_data_tx[desc], SERCOM_BRIDGE, NULL, BRIDGE_CTRL_SIZE_V2);
+    dma_fill_sercom_rx(&dma_chain_data_rx[desc], SERCOM_BRIDGE, ctrl_rx_buf, BRIDGE_CTRL_SIZE_V2);
+    desc++;
+    dma_fill_sercom_tx(&dma_chain_data_tx[desc], SERCOM_BRIDGE, ctrl_tx_buf, BRIDGE_CTRL_SIZE_V2);
+    dma_fill_sercom_rx(&dma_chain_data_rx[desc], SERCOM_BRIDGE, NULL, BRIDGE_CTRL_SIZE_V2);
+    desc++;
+
+    dma_link_chain(dma_chain_data_tx, desc);
+    dma_link_chain(dma_chain_data_rx, desc);
+    dma_start_descriptor(DMA_BRIDGE_TX, &dma_chain_data_tx[0]);
+    dma_start_descriptor(DMA_BRIDGE_RX, &dma_chain_data_rx[0]);
+    DMAC->CHINTFLAG.reg = DMAC_CHINTFLAG_TCMPL | DMAC_CHINTFLAG_TERR; // note: depends on ID from previous call
+
+    // Completions are processed once the header exchange at the end of the chain finishes
+    if (data_phase || bridge_done_count > 0) {
+        DMAC->CHINTENSET.reg = DMAC_CHINTENSET_TCMPL | DMAC_CHINTENSET_TERR;
+    } else {
+        DMAC->CHINTENCLR.reg = DMAC_CHINTENSET_TCMPL | DMAC_CHINTENSET_TERR;
+    }
+    bridge_state = data_phase ? BRIDGE_STATE_DATA : BRIDGE_STATE_CTRL;
+
+    pin_low(PIN_BRIDGE_IRQ);
+}
+
 void bridge_handle_sync() {
-    if (pin_read(PIN_BRIDGE_SYNC) == 0) {
+    if (bridge_pipelined) {
+        bridge_handle_sync_pipelined();
+    } else if (pin_read(PIN_BRIDGE_SYNC) == 0) {
         // Reset SERCOM to clear FIFOs and prepare for header packet
         dma_abort(DMA_BRIDGE_TX);
         dma_abort(DMA_BRIDGE_RX);
 
         sercom_spi_slave_init(SERCOM_BRIDGE, BRIDGE_DIPO, BRIDGE_DOPO, 1, 1);
 
-        ctrl_rx.cmd = 0x00;
-        ctrl_tx.cmd = 0xCA;
-        for (u8 chan=0; chan<BRIDGE_NUM_CHAN; chan++) {
-            ctrl_tx.size[chan] = in_chan_size[chan];
-        }
-        ctrl_tx.status = out_chan_ready;
+        ctrl_rx_buf[0] = 0x00;
+        bridge_build_ctrl_tx(&ctrl_tx);
+        bridge_encode_ctrl_tx(&ctrl_tx);
+        bridge_fill_control_chain();
 
         dma_start_descriptor(DMA_BRIDGE_TX, &dma_chain_control_tx[0]);
         dma_start_descriptor(DMA_BRIDGE_RX, &dma_chain_control_rx[0]);
@@ -106,7 +402,7 @@ void bridge_handle_sync() {
         bridge_state = BRIDGE_STATE_CTRL;
     } else {
         // Configure DMA for the data phase
-        if (ctrl_rx.cmd != 0x53) {
+        if (!bridge_decode_ctrl_rx()) {
             bridge_state = BRIDGE_STATE_IDLE;
             return;
         }
@@ -114,26 +410,7 @@ void bridge_handle_sync() {
         // Set this flag so the LED boot sequence stops
         booted = true;
 
-        u8 desc = 0;
-
-        // Create DMA chain
-        for (u8 chan=0; chan<BRIDGE_NUM_CHAN; chan++) {
-            u8 size = ctrl_rx.size[chan];
-            if (ctrl_tx.status & (1<<chan) && size > 0) {
-                out_chan_ready &= ~ (1<<chan);
-                dma_fill_sercom_tx(&dma_chain_data_tx[desc], SERCOM_BRIDGE, NULL, size);
-                dma_fill_sercom_rx(&dma_chain_data_rx[desc], SERCOM_BRIDGE, out_chan_ptr[chan], size);
-                desc++;
-            }
-
-            size = ctrl_tx.size[chan];
-            if (ctrl_rx.status & (1<<chan) && size > 0) {
-                in_chan_size[chan] = 0;
-                dma_fill_sercom_tx(&dma_chain_data_tx[desc], SERCOM_BRIDGE, in_chan_ptr[chan], size);
-                dma_fill_sercom_rx(&dma_chain_data_rx[desc], SERCOM_BRIDGE, NULL, size);
-                desc++;
-            }
-        }
+        u8 desc = bridge_fill_data_chain();
 
         if (desc > 0) {
             dma_link_chain(dma_chain_data_tx, desc);
@@ -160,66 +437,83 @@ void bridge_handle_sync() {
     }
 }
 
-void bridge_dma_rx_completion() {
-    if (bridge_state == BRIDGE_STATE_DATA) {
-
-        // Copy the global state to this stack frame in case SYNC changes and the ISR overwrites these
-        uint8_t rx_status = ctrl_rx.status;
-        uint8_t tx_status = ctrl_tx.status;
-        uint8_t rx_size[BRIDGE_NUM_CHAN];
-        memcpy(rx_size, ctrl_rx.size, sizeof(rx_size));
-        uint8_t tx_size[BRIDGE_NUM_CHAN];
-        memcpy(tx_size, ctrl_tx.size, sizeof(tx_size));
-        __asm__ __volatile__ ("" : : : "memory");
-
-        #define CHECK_OPEN(x) \
-            if ((rx_status & (0x10<<x)) && !(was_open & (0x10<<x))) { \
-                bridge_open_##x(rx_size[x]); \
-            }
+/// Run the open, close and transfer completion callbacks for a finished data phase
+void bridge_process_done(BridgeDone* d) {
+    #define CHECK_OPEN(x) \
+        if ((d->rx_status & (0x10<<x)) && !(was_open & (0x10<<x))) { \
+            bridge_open_##x(d->rx_size[x]); \
+        }
 
-        #define CHECK_COMPLETION_OUT(x) \
-            if (tx_status & (1<<x) && rx_size[x] > 0) { \
-                bridge_completion_out_##x(rx_size[x]); \
-            }
+    #define CHECK_COMPLETION_OUT(x) \
+        if (d->tx_status & (1<<x) && d->rx_size[x] > 0) { \
+            bridge_completion_out_##x(d->rx_size[x]); \
+        }
 
-        #define CHECK_COMPLETION_IN(x) \
-            if (rx_status & (1<<x) && tx_size[x] > 0) { \
+    #define CHECK_COMPLETION_IN(x) \
+        if (d->rx_status & (1<<x) && d->tx_size[x] > 0) { \
+            if (d->in_last & (1<<x)) { \
                 bridge_completion_in_##x(); \
-            }
+            } else { \
+                pin_high(PIN_BRIDGE_IRQ); \
+            } \
+        }
 
-        #define CHECK_CLOSE(x) \
-            if (!(rx_status & (0x10<<x)) && (was_open & (0x10<<x))) { \
-                bridge_close_##x(rx_size[x]); \
-            }
+    #define CHECK_CLOSE(x) \
+        if (!(d->rx_status & (0x10<<x)) && (was_open & (0x10<<x))) { \
+            bridge_close_##x(d->rx_size[x]); \
+        }
+
+    CHECK_OPEN(0)
+    CHECK_OPEN(1)
+    CHECK_OPEN(2)
 
-        CHECK_OPEN(0)
-        CHECK_OPEN(1)
-        CHECK_OPEN(2)
+    CHECK_COMPLETION_OUT(0);
+    CHECK_COMPLETION_OUT(1);
+    CHECK_COMPLETION_OUT(2);
 
-        CHECK_COMPLETION_OUT(0);
-        CHECK_COMPLETION_OUT(1);
-        CHECK_COMPLETION_OUT(2);
+    CHECK_COMPLETION_IN(0);
+    CHECK_COMPLETION_IN(1);
+    CHECK_COMPLETION_IN(2);
 
-        CHECK_COMPLETION_IN(0);
-        CHECK_COMPLETION_IN(1);
-        CHECK_COMPLETION_IN(2);
+    CHECK_CLOSE(0)
+    CHECK_CLOSE(1)
+    CHECK_CLOSE(2)
 
-        CHECK_CLOSE(0)
-        CHECK_CLOSE(1)
-        CHECK_CLOSE(2)
 
+    #undef CHECK_OPEN
+    #undef CHECK_COMPLETION_OUT
+    #undef CHECK_COMPLETION_IN
+    #undef CHECK_CLOSE
 
-        #undef CHECK_OPEN
-        #undef CHECK_COMPLETION_OUT
-        #undef CHECK_COMPLETION_IN
-        #undef CHECK_CLOSE
+    was_open = d->rx_status & 0xF0;
+}
 
-        was_open = ctrl_rx.status & 0xF0;
+void bridge_dma_rx_completion() {
+    // Queue this data phase along with any that a SYNC edge queued before this interrupt ran,
+    // so they are processed in order. A SYNC edge can't be allowed to queue it a second time.
+    __disable_irq();
+    if (bridge_state == BRIDGE_STATE_DATA) {
+        bridge_queue_done();
         bridge_state = BRIDGE_STATE_IDLE;
     }
+    __enable_irq();
+
+    while (true) {
+        __disable_irq();
+        if (bridge_done_count == 0) {
+            __enable_irq();
+            break;
+        }
+        BridgeDone d = bridge_done[bridge_done_head];
+        bridge_done_head = (bridge_done_head + 1) % BRIDGE_DONE_SIZE;
+        bridge_done_count--;
+        __enable_irq();
+
+        bridge_process_done(&d);
+    }
 }
 
-void bridge_start_in(u8 channel, u8* data, u8 length) {
+void bridge_start_in(u8 channel, u8* data, u16 length) {
     __disable_irq();
     in_chan_ptr[channel] = data;
     in_chan_size[channel] = length;
@@ -6,6 +6,8 @@
 /// DMA allocation. Channels 0-3 support EVSYS and are reserved for
 /// functions that need it
 #define DMA_TERMINAL_RX 0
+#define DMA_ADC_RESULT 1
+#define DMA_ADC_SEQ 2 // must be one of 0-3, which take event triggers
 #define DMA_BRIDGE_TX 4
 #define DMA_BRIDGE_RX 5
 #define DMA_PORT_A_TX 6
@@ -13,6 +15,7 @@
 #define DMA_PORT_B_TX 8
 #define DMA_PORT_B_RX 9
 #define DMA_TERMINAL_TX 10
+#define DMA_DAC_WAVE 11
 
 
 // overlaps with flash because they cannot be active at the same time
@@ -22,6 +25,12 @@
 /// EVSYS allocation
 #define EVSYS_BRIDGE_SYNC 0
 #define EVSYS_TERMINAL_TIMEOUT 1
+#define EVSYS_ADC_START 2
+#define EVSYS_ADC_RESRDY 3
+#define EVSYS_DAC_START 4
+#define EVSYS_CAPTURE_START 5
+#define EVSYS_COUNTER_A 6
+#define EVSYS_COUNTER_B 7
 
 /// USB Endpoint allocation
 #define USB_EP_FLASH_OUT 0x02
@@ -37,6 +46,8 @@
 /// Timer allocation
 #define TC_TERMINAL_TIMEOUT 3
 #define TC_BOOT             4
+#define TC_PORT_A           4 // shared with TC_BOOT, which is only used before the ports start
+#define TC_PORT_B           5
 
 // TCC allocation
 // muxed with i2c. also used for uart read timers
@@ -68,15 +79,18 @@ extern u8 flash_buffer[FLASH_BUFFER_SIZE];
 #define BRIDGE_USB 0
 #define BRIDGE_PORT_A 1
 #define BRIDGE_PORT_B 2
-#define BRIDGE_BUF_SIZE 255
-#define BRIDGE_ARG_SIZE 5
+// Largest frame per channel per sync cycle. Frames with a v1 (8-bit length) header are limited
+// to BRIDGE_BUF_SIZE_V1; larger IN frames are split across cycles by the bridge.
+#define BRIDGE_BUF_SIZE 1024
+#define BRIDGE_BUF_SIZE_V1 255
+#define BRIDGE_ARG_SIZE 6
 
 void bridge_init();
 void bridge_disable();
 void bridge_handle_sync();
 void bridge_dma_rx_completion();
 
-void bridge_start_in(u8 channel, u8* data, u8 length);
+void bridge_start_in(u8 channel, u8* data, u16 length);
 void bridge_start_out(u8 channel, u8* data);
 void bridge_enable_chan(u8 channel);
 void bridge_disable_chan(u8 channel);
@@ -86,10 +100,10 @@ void bridge_completion_in_1();
 void bridge_completion_in_2();
 void bridge_completion_in_3();
 
-void bridge_completion_out_0(u8 size);
-void bridge_completion_out_1(u8 size);
-void bridge_completion_out_2(u8 size);
-void bridge_completion_out_3(u8 size);
+void bridge_completion_out_0(u16 size);
+void bridge_completion_out_1(u16 size);
+void bridge_completion_out_2(u16 size);
+void bridge_completion_out_3(u16 size);
 
 void bridge_open_0();
 void bridge_open_1();
@@ -107,12 +121,65 @@ void init_breathing_animation();
 // port.c
 
 #define UART_MS_TIMEOUT 10 // send uart data after ms timeout even if buffer is not full
-#define UART_RX_SIZE 32
+
+// Size of the ring that UART data is received into by DMA, in two halves
+#define UART_RX_SIZE 512
+
+// Received UART bytes are checked every UART_RX_POLL_TICKS of the 187.5kHz timer (about 2ms), and
+// sent once the line has been idle for a check or UART_RX_SIZE / 4 bytes are waiting
+#define UART_RX_POLL_TICKS 400
+
+// Bytes of the ring left alone when catching up after an overrun, as DMA is about to overwrite them
+#define UART_RX_MARGIN 16
+
+// Number of bridge buffers in each of a port's command and reply rings. With two, the next
+// command packet is received and the previous reply packet is sent while the port executes.
+#define PORT_RING_SIZE 2
+
+// Size of the buffer for replies to tagged commands executed out of order
+#define PORT_EXPRESS_SIZE 32
+
+// Maximum length of a stored command program
+#define PORT_PROG_SIZE 255
+
+// Number of samples in each half of the ADC stream's double buffer
+#define ADC_STREAM_BLOCK 120
+
+// Maximum number of samples in the DAC waveform table
+#define DAC_WAVE_SIZE 256
+
+// Size of the logic analyzer's sample buffer, shared by the ports
+#define CAPTURE_SIZE 8192
+
+// Size of the pattern generator's table of output toggles, shared by the ports
+#define PATTERN_SIZE 2048
+
+// Largest addressable LED strip frame, in bytes of color data, shared by the ports
+#define LED_STRIP_SIZE 1536
+
+// Bytes of color data expanded into each SPI transfer of an LED strip frame
+#define LED_STRIP_CHUNK 32
+
+// Number of timestamped pin events held until they are sent
+#define PIN_EVENTS_SIZE 32
 
 typedef struct UartBuf {
-    u8 head;
-    u8 tail;
-    u8 buf_len;
+    /// Ring of descriptors that write the halves of rx in turn
+    DMA_DESC_ALIGN DmacDescriptor desc[2];
+
+    /// Half of rx being written
+    u8 filling;
+
+    /// Bytes received before the half being written, bytes sent, and bytes received at the last
+    /// check for an idle line. They wrap around, and only their differences are used.
+    u32 base;
+    u32 sent;
+    u32 polled;
+
+    /// Bytes overwritten before they were sent, and bytes lost by the SERCOM, since CMD_UART_STATUS
+    u16 dropped;
+    u16 overflows;
+
     u8 rx[UART_RX_SIZE];
 } UartBuf;
 
@@ -120,11 +187,17 @@ typedef struct PortData {
     /// Pin mappings
     const TesselPort* port;
 
-    /// Buffers for data from the host
-    USB_ALIGN u8 cmd_buf[BRIDGE_BUF_SIZE];
+    /// Ring of buffers for data from the host
+    USB_ALIGN u8 cmd_ring[PORT_RING_SIZE][BRIDGE_BUF_SIZE];
+
+    /// Ring of buffers for data to the host
+    USB_ALIGN u8 reply_ring[PORT_RING_SIZE][BRIDGE_BUF_SIZE];
+
+    /// Command buffer being parsed (cmd_ring[cmd_head])
+    u8* cmd_buf;
 
-    /// Buffers for data to the host
-    USB_ALIGN u8 reply_buf[BRIDGE_BUF_SIZE];
+    /// Reply buffer being filled (the slot after the reply_count queued ones)
+    u8* reply_buf;
 
     /// Bridge channel
     u8 chan;
@@ -142,13 +215,27 @@ typedef struct PortData {
     u8 mode;
 
     /// Length of valid data in cmd_buf
-    u8 cmd_len;
+    u16 cmd_len;
 
     /// Current position in cmd_buf
-    u8 cmd_pos;
+    u16 cmd_pos;
 
     /// Current write position in reply_buf (length of valid data written)
-    u8 reply_len;
+    u16 reply_len;
+
+    /// cmd_ring slot being parsed, and number of received slots starting there
+    u8 cmd_head;
+    u8 cmd_count;
+
+    /// Length of valid data in each received cmd_ring slot
+    u16 cmd_lens[PORT_RING_SIZE];
+
+    /// Oldest queued reply_ring slot, and number of queued slots (sent or waiting to be sent)
+    u8 reply_head;
+    u8 reply_count;
+
+    /// Length of each queued reply_ring slot
+    u16 reply_lens[PORT_RING_SIZE];
 
     /// Currently executing command (PortCmd in port.c)
     u8 cmd;
@@ -168,11 +255,135 @@ typedef struct PortData {
     /// TCC channel for this port
     u8 tcc_channel;
 
-    /// True if the port is waiting for a packet from the host
+    /// TC channel that schedules program iterations
+    u8 tc_channel;
+
+    /// True if the port is waiting for a packet from the host into the next free cmd_ring slot
     bool pending_out;
 
-    /// True if the port is sending a packet to the host
+    /// True if the port is sending the reply_ring slot at reply_head to the host
     bool pending_in;
+
+    /// True if the port is sending express_buf to the host instead of a reply_ring slot
+    bool pending_in_express;
+
+    /// Tag set by CMD_TAG for the next command
+    u8 tag;
+    bool tag_pending;
+
+    /// True if the executing command's reply is prefixed with REPLY_TAGGED and its tag
+    bool cmd_tagged;
+
+    /// Replies to tagged commands executed while another command is in progress. These are sent
+    /// ahead of the reply ring.
+    u8 express_buf[PORT_EXPRESS_SIZE];
+    u8 express_len;
+
+    /// Command program stored by CMD_PROG_LOAD
+    u8 prog_buf[PORT_PROG_SIZE];
+    u8 prog_len;
+
+    /// Largest reply one iteration of the program can produce
+    u16 prog_reply_size;
+
+    /// True while CMD_PROG_RUN has the program scheduled
+    bool prog_running;
+
+    /// True if the timer has expired and an iteration should start at the next command boundary
+    bool prog_due;
+
+    /// True while the parser is executing prog_buf in place of the command ring
+    bool prog_active;
+
+    /// Position in cmd_buf to resume at when the iteration finishes
+    u16 prog_resume_pos;
+
+    /// Start of the iteration's REPLY_ASYNC_PROG_DATA frame in reply_buf
+    u16 prog_frame;
+
+    /// Iterations left if !prog_forever
+    u16 prog_remaining;
+    bool prog_forever;
+
+    /// Number of iterations to collect in reply_buf before sending them, and count so far
+    u8 prog_batch;
+    u8 prog_batched;
+
+    /// Length of the program replies in reply_buf being held until the batch is complete
+    u16 prog_held;
+
+    /// EIC flag of the pin that triggers program iterations (0 if none), and its pin index
+    u32 prog_trigger;
+    u8 prog_trigger_pin;
+
+    /// True if CMD_START deferred addressing i2c_addr to the following TX or RX, which is made as
+    /// one DMA transfer
+    bool i2c_dma;
+    u8 i2c_addr;
+
+    /// Outcome of the I2C transaction since the last CMD_START (PortReply in port.c), and true if
+    /// it failed and its remaining commands up to CMD_STOP are skipped
+    u8 i2c_status;
+    bool i2c_failed;
+
+    /// CMD_SPI_CS argument without FLAG_SPI_CS_HOLD (0 if the firmware doesn't drive a chip
+    /// select), and true if the chip select is held asserted between transfers
+    u8 spi_cs;
+    bool spi_cs_hold;
+
+    /// Pin driven as the UART's RTS if uart_rts, and the EIC flag of the pin read as its CTS (0 if
+    /// none) and the pin's index. Both are active low.
+    bool uart_rts;
+    u8 uart_rts_pin;
+    u32 uart_cts;
+    u8 uart_cts_pin;
+
+    /// EIC flags of the pins whose interrupts are recorded as timestamped events (0 if
+    /// CMD_GPIO_EVENTS is off)
+    u32 pin_events;
+
+    /// Ring of recorded events not yet sent: the pin index with its level in bit 3, and the time in
+    /// microseconds
+    u8 event_head;
+    u8 event_count;
+    u8 event_pin[PIN_EVENTS_SIZE];
+    u32 event_time[PIN_EVENTS_SIZE];
+
+    /// Events lost because the ring was full, since the last REPLY_ASYNC_PIN_EVENTS
+    u16 events_dropped;
+
+    /// EIC flag of the pin measured by CMD_GPIO_PULSE (0 if none), and the pin's index
+    u32 pulse;
+    u8 pulse_pin;
+
+    /// EIC sense of the edge that ends the pulse, and the time in microseconds of the edge that
+    /// started it, if pulse_started
+    u8 pulse_end;
+    bool pulse_started;
+    u32 pulse_start;
+
+    /// Milliseconds left before the measurement times out
+    u16 pulse_timeout;
+
+    /// CMD_CAPTURE_TRIGGER argument: the pin that starts a capture, with its EIC sense in bits 4-6
+    /// (0 to start right away), and milliseconds to wait for it
+    u8 capture_trigger;
+    u16 capture_timeout;
+
+    /// EIC flag of the pin whose edges CMD_COUNTER_START counts with the port's TC (0 if none), the
+    /// pin's index, and the TC's overflows, which extend the count to 32 bits
+    u32 counter;
+    u8 counter_pin;
+    u16 counter_overflows;
+
+    /// EIC flags of the encoder pins decoded by CMD_QUAD_START (0 if none), their indexes, their
+    /// last levels (A in bit 1, B in bit 0), and the position counted
+    u32 quad;
+    u8 quad_pin_a;
+    u8 quad_pin_b;
+    u8 quad_state;
+    int32_t quad_position;
+
     UartBuf uart_buf;
 } PortData;
 
@@ -180,16 +391,21 @@ extern PortData port_a;
 extern PortData port_b;
 
 void port_init(PortData* p, u8 chan, const TesselPort* port,
-    u8 clock_channel, u8 tcc_channel, DmaChan dma_tx, DmaChan dma_rx);
+    u8 clock_channel, u8 tcc_channel, u8 tc_channel, DmaChan dma_tx, DmaChan dma_rx);
 void port_enable(PortData *p);
-void port_bridge_out_completion(PortData* p, u8 len);
+void port_bridge_out_completion(PortData* p, u16 len);
 void port_bridge_in_completion(PortData* p);
 void port_dma_rx_completion(PortData* p);
 void port_dma_tx_completion(PortData* p);
 void port_handle_sercom_uart_i2c(PortData* p);
 void port_handle_extint(PortData *p, u32 flags);
+void port_handle_tc(PortData *p);
+void port_handle_systick(PortData *p);
+void port_adc_stream_completion();
+void port_dac_wave_completion();
 void port_disable(PortData *p);
 void uart_send_data(PortData *p);
+void port_uart_poll(PortData *p);
 
 // usbpipe.c
 
@@ -197,7 +413,7 @@ void usbpipe_init();
 void usbpipe_disable();
 void pipe_usb_out_completion();
 void pipe_bridge_in_completion();
-void pipe_bridge_out_completion(u8 count);
+void pipe_bridge_out_completion(u16 count);
 void pipe_usb_in_completion();
 
 // usbserial.c
@@ -234,15 +234,17 @@ int main(void) {
     NVIC_EnableIRQ(EVSYS_IRQn);
     NVIC_SetPriority(EVSYS_IRQn, 0);
 
+    timestamp_init();
+
     adc_init(GCLK_SYSTEM, ADC_REFCTRL_REFSEL_INTVCC1);
     dac_init(GCLK_32K);
 
     bridge_init();
 
     port_init(&port_a, 1, &PORT_A, GCLK_PORT_A,
-        TCC_PORT_A, DMA_PORT_A_TX, DMA_PORT_A_RX);
+        TCC_PORT_A, TC_PORT_A, DMA_PORT_A_TX, DMA_PORT_A_RX);
     port_init(&port_b, 2, &PORT_B, GCLK_PORT_B,
-        TCC_PORT_B, DMA_PORT_B_TX, DMA_PORT_B_RX);
+        TCC_PORT_B, TC_PORT_B, DMA_PORT_B_TX, DMA_PORT_B_RX);
 
     __enable_irq();
     SCB->SCR |= SCB_SCR_SLEEPONEXIT_Msk;
@@ -274,6 +276,10 @@ void DMAC_Handler() {
             usbserial_dma_rx_completion();
         } else if (id == DMA_TERMINAL_TX) {
             usbserial_dma_tx_completion();
+        } else if (id == DMA_ADC_RESULT) {
+            port_adc_stream_completion();
+        } else if (id == DMA_DAC_WAVE) {
+            port_dac_wave_completion();
         }
     }
 
@@ -284,8 +290,15 @@ void DMAC_Handler() {
     DMAC->INTPEND.reg = intpend;
 }
 
+void SysTick_Handler() {
+    timestamp_tick();
+    port_handle_systick(&port_a);
+    port_handle_systick(&port_b);
+}
+
 void EIC_Handler() {
-    u32 flags = EIC->INTFLAG.reg;
+    // Flags of disabled interrupts stay latched until their port enables them
+    u32 flags = EIC->INTFLAG.reg & EIC->INTENSET.reg;
     if (flags &  EIC_INTFLAG_EXTINT9) {
         handle_reset_pin();
     } else if (flags & PORT_A.pin_interrupts) {
@@ -314,7 +327,7 @@ void SERCOM_HANDLER(SERCOM_PORT_B_UART_I2C) {
 
 void bridge_open_0() {}
 
-void bridge_completion_out_0(u8 count) {
+void bridge_completion_out_0(u16 count) {
     pipe_bridge_out_completion(count);
 }
 void bridge_completion_in_0() {
@@ -325,7 +338,7 @@ void bridge_close_0() {}
 void bridge_open_1() {
     port_enable(&port_a);
 }
-void bridge_completion_out_1(u8 count) {
+void bridge_completion_out_1(u16 count) {
     port_bridge_out_completion(&port_a, count);
 }
 void bridge_completion_in_1() {
@@ -338,7 +351,7 @@ void bridge_close_1() {
 void bridge_open_2() {
     port_enable(&port_b);
 }
-void bridge_completion_out_2(u8 count) {
+void bridge_completion_out_2(u16 count) {
     port_bridge_out_completion(&port_b, count);
 }
 void bridge_completion_in_2() {
@@ -352,15 +365,23 @@ void TC_HANDLER(TC_TERMINAL_TIMEOUT) {
     usbserial_handle_tc();
 }
 
+void TC_HANDLER(TC_PORT_A) {
+    port_handle_tc(&port_a);
+}
+
+void TC_HANDLER(TC_PORT_B) {
+    port_handle_tc(&port_b);
+}
+
 void TCC_HANDLER(TCC_PORT_A) {
-    uart_send_data(&port_a);
+    port_uart_poll(&port_a);
 
     // clear irq
     tcc(TCC_PORT_A)->INTFLAG.reg = TCC_INTENSET_OVF;
 }
 
 void TCC_HANDLER(TCC_PORT_B) {
-    uart_send_data(&port_b);
+    port_uart_poll(&port_b);
 
     // clear irq
     tcc(TCC_PORT_B)->INTFLAG.reg = TCC_INTENSET_OVF;
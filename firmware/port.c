@@ -54,20 +54,85 @@ typedef enum PortCmd {
     CMD_STOP = 20,
     CMD_PWM_DUTY_CYCLE = 27,
     CMD_PWM_PERIOD = 28,
+    CMD_TAG = 29, // tag the reply of the next command, allowing it to complete out of order
+    CMD_PROG_LOAD = 30, // store a program of commands
+    CMD_PROG_RUN = 31, // run the stored program periodically
+    CMD_PROG_STOP = 32,
+    CMD_PROG_TRIGGER = 33, // run the stored program on each interrupt of a pin
+    CMD_ADC_STREAM_START = 34, // sample a set of pins with the ADC at a fixed rate
+    CMD_ADC_STREAM_STOP = 35,
+    CMD_DAC_WAVE_LOAD = 36, // store a table of DAC samples
+    CMD_DAC_WAVE_PLAY = 37, // write the table to the DAC at a fixed rate
+    CMD_DAC_WAVE_STOP = 38,
+    CMD_I2C_READ_REG = 39, // write a register number, then read from it after a repeated start
+    CMD_I2C_STATUS = 40, // reply with the outcome of the last I2C transaction
+    CMD_I2C_SCAN = 41, // probe every I2C address, replying with a bitmap of those that ACK
+    CMD_SPI_CS = 42, // select the pin asserted around each SPI transfer
+    CMD_TX_LONG = 43, // CMD_TX with a 16-bit length
+    CMD_RX_LONG = 44, // CMD_RX with a 16-bit length
+    CMD_TXRX_LONG = 45, // CMD_TXRX with a 16-bit length
+    CMD_UART_STATUS = 46, // reply with the UART receive overrun counts, and reset them
+    CMD_UART_FLOW = 47, // set up RTS/CTS flow control on spare pins
+    CMD_GPIO_READ_ALL = 48, // read the levels of all 8 pins into one byte, pin n in bit n
+    CMD_GPIO_WRITE_MASK = 49, // write the levels of the pins in a mask
+    CMD_GPIO_DIR_MASK = 50, // switch the pins in a mask to output (1) or input (0)
+    CMD_GPIO_EVENTS = 51, // report pin interrupts as batches of timestamped events
+    CMD_GPIO_PULSE = 52, // measure the length of a pulse on a pin, in microseconds
+    CMD_CAPTURE_TRIGGER = 53, // set the pin edge that starts the next captures
+    CMD_CAPTURE = 54, // sample all 8 pins at a fixed rate into RAM, then send the samples
+    CMD_PATTERN_LOAD = 55, // store a table of pin levels for the pattern generator
+    CMD_PATTERN_PLAY = 56, // write the table to the pins at a fixed rate
+    CMD_PATTERN_STOP = 57,
+    CMD_COUNTER_START = 58, // count the edges of a pin in hardware with the port's TC
+    CMD_COUNTER_READ = 59, // reply with the edge count and the time of the read
+    CMD_QUAD_START = 60, // decode a quadrature encoder on two interrupt pins
+    CMD_QUAD_READ = 61, // reply with the encoder position
+    CMD_LED_STRIP = 62, // send a frame of color data to WS2812 LEDs through SPI
 } PortCmd;
 
 #define FLAG_SPI_CPOL (1<<0)
 #define FLAG_SPI_CPHA (1<<1)
 
+// CMD_SPI_CS argument: pin index in the low 3 bits, and flags
+#define FLAG_SPI_CS_ACTIVE_HIGH (1<<3)
+#define FLAG_SPI_CS_HOLD (1<<6) // assert now, and keep asserted until the next CMD_SPI_CS
+#define FLAG_SPI_CS_ENABLE (1<<7)
+
+#define FLAG_DAC_WAVE_LOOP (1<<0)
+
+// CMD_UART_FLOW argument: RTS pin index in bits 0-2, CTS pin index in bits 3-5, and flags
+#define FLAG_UART_RTS (1<<6)
+#define FLAG_UART_CTS (1<<7)
+
+#define FLAG_GPIO_EVENTS_ENABLE (1<<0)
+
+#define FLAG_PATTERN_LOOP (1<<0)
+
+// CMD_QUAD_START argument: pin A index in bits 0-2, pin B index in bits 3-5, and flags
+#define FLAG_QUAD_ENABLE (1<<7)
+
 typedef enum {
     REPLY_ACK = 0x80,
     REPLY_NACK = 0x81,
     REPLY_HIGH = 0x82,
     REPLY_LOW  = 0x83,
     REPLY_DATA = 0x84,
+    REPLY_TAGGED = 0x85, // followed by the tag and the tagged command's reply
+    REPLY_I2C_BUS_ERROR = 0x86,
+    REPLY_I2C_ARB_LOST = 0x87,
+    REPLY_TIMEOUT = 0x88, // in place of the reply of a command that waited too long
+    REPLY_BUSY = 0x89, // in place of the reply of a command whose resources are in use
+
+    REPLY_ASYNC_PROG_END = 0xA1, // the program has run the requested number of iterations
+    REPLY_ASYNC_ADC_OVERRUN = 0xA2, // ADC stream samples were dropped before the next block
+    REPLY_ASYNC_DAC_WAVE_END = 0xA3, // one-shot DAC waveform playback has finished
+    REPLY_ASYNC_PATTERN_END = 0xA4, // one-shot pattern playback has finished
 
     REPLY_ASYNC_PIN_CHANGE_N = 0xC0, // 0xC0 + n
     REPLY_ASYNC_UART_RX = 0xD0,
+    REPLY_ASYNC_PROG_DATA = 0xD1, // followed by a 16-bit length and the replies of one iteration
+    REPLY_ASYNC_ADC_DATA = 0xD2, // followed by a 16-bit length and a block of ADC stream samples
+    REPLY_ASYNC_PIN_EVENTS = 0xD3, // followed by an event count, a 16-bit dropped count and events
 } PortReply;
 
 typedef enum PortMode {
@@ -83,6 +148,170 @@ typedef enum PullMode {
     PULL_NONE = 2,
 } PullMode;
 
+typedef enum PulseMode {
+    PULSE_HIGH = 0, // from a rising edge to the next falling edge
+    PULSE_LOW = 1, // from a falling edge to the next rising edge
+    PULSE_PERIOD = 2, // from a rising edge to the next rising edge
+} PulseMode;
+
+// Space needed in reply_buf to begin a command: a tag prefix and the largest fixed-size reply,
+// which is CMD_COUNTER_READ's
+#define PORT_REPLY_RESERVE 11
+
+// I2C addresses probed by CMD_I2C_SCAN, excluding the reserved ones, and the size of its reply's
+// bitmap of all 128 addresses
+#define I2C_SCAN_FIRST 0x08
+#define I2C_SCAN_LAST 0x77
+#define I2C_SCAN_SIZE 16
+
+// Size of each event in a REPLY_ASYNC_PIN_EVENTS frame: the pin and level, and a 32-bit time
+#define PIN_EVENT_SIZE 5
+
+// Size of the REPLY_ASYNC_PROG_DATA header that starts each program iteration's replies
+#define PORT_PROG_FRAME_HEADER 3
+
+/// State of the ADC stream. There is one ADC, so one port at a time owns the stream.
+typedef struct AdcStream {
+    /// Port that receives the samples, or NULL if the stream is stopped
+    PortData* owner;
+
+    /// INPUTCTRL values written by DMA_ADC_SEQ after each conversion, starting with the second
+    /// channel
+    u32 seq[8];
+
+    /// Samples in each block, a whole number of rounds of the channels
+    u16 block;
+
+    /// Half of buf that DMA_ADC_RESULT is filling
+    u8 filling;
+
+    /// True if the other half of buf holds a block waiting to be sent
+    bool ready;
+
+    /// True if a block was dropped since the last one sent
+    bool overrun;
+
+    u16 buf[2][ADC_STREAM_BLOCK];
+} AdcStream;
+
+AdcStream adc_stream;
+DMA_DESC_ALIGN DmacDescriptor adc_stream_result_desc[2];
+DMA_DESC_ALIGN DmacDescriptor adc_stream_seq_desc;
+
+/// State of DAC waveform playback. The DAC is on port B, but either port may play the table
+/// using its own TC.
+typedef struct DacWave {
+    /// Port whose TC paces playback, or NULL if playback is stopped
+    PortData* owner;
+
+    /// Number of samples in buf
+    u16 len;
+
+    /// Bytes of buf received so far by CMD_DAC_WAVE_LOAD
+    u16 loaded;
+
+    /// True if one-shot playback has finished and REPLY_ASYNC_DAC_WAVE_END has not been sent
+    bool ended;
+
+    u16 buf[DAC_WAVE_SIZE];
+} DacWave;
+
+DacWave dac_wave;
+DMA_DESC_ALIGN DmacDescriptor dac_wave_desc;
+
+/// The bytes of a PORT register that hold a port's pins, one lane per group of its pins. DMA
+/// transfers a lane of each group's register per step, paced by the port's TC.
+typedef struct PinLanes {
+    u8 count;
+    u8 group[2];
+    u8 offset[2];
+    u8 size[2];
+
+    /// Where the values of each lane start in a buffer
+    u8* buf[2];
+
+    /// Lane and bit within it of each of the port's pins
+    u8 pin_lane[8];
+    u8 pin_bit[8];
+} PinLanes;
+
+/// State of a logic analyzer capture. The buffer is shared, so one port at a time captures.
+typedef struct LogicCapture {
+    /// Port that is capturing or sending samples, or NULL
+    PortData* owner;
+
+    /// The bytes of the PORT IN registers copied for each sample
+    PinLanes lanes;
+
+    /// Samples requested, and samples sent so far
+    u16 count;
+    u16 sent;
+
+    /// EIC flag of the pin that starts sampling (0 if none), true until sampling has started, and
+    /// milliseconds left to wait for it
+    u32 trigger;
+    bool waiting;
+    u16 timeout;
+
+    u8 buf[CAPTURE_SIZE];
+} LogicCapture;
+
+LogicCapture logic_capture;
+
+/// State of the pattern generator, which writes a table of pin levels to a port's pins at a fixed
+/// rate. The table is shared, so one port at a time plays it.
+typedef struct PatternGen {
+    /// Port whose TC and DMA channels play the table, or NULL if playback is stopped
+    PortData* owner;
+
+    /// Port the table was loaded for, and the bytes of its PORT OUTTGL registers written per step
+    PortData* port;
+    PinLanes lanes;
+
+    /// Pins driven by the table
+    u8 mask;
+
+    /// Number of steps in the table, and steps received so far by CMD_PATTERN_LOAD
+    u16 len;
+    u16 loaded;
+
+    /// Pin levels of the first step and of the last step received
+    u8 first;
+    u8 last;
+
+    /// True if one-shot playback has finished and REPLY_ASYNC_PATTERN_END has not been sent
+    bool ended;
+
+    /// The toggles of each lane from one step to the next, followed by the toggles from the last
+    /// step back to the first
+    u8 buf[PATTERN_SIZE];
+} PatternGen;
+
+PatternGen pattern;
+DMA_DESC_ALIGN DmacDescriptor pattern_desc[2];
+
+/// State of an addressable LED strip frame. The frame is received whole before it is sent, as a
+/// pause in the middle would latch it early. The buffer is shared, so one port at a time sends.
+typedef struct LedStrip {
+    /// Port receiving or sending a frame, or NULL
+    PortData* owner;
+
+    /// Bytes of color data in the frame, received so far, and expanded for SPI so far
+    u16 len;
+    u16 loaded;
+    u16 encoded;
+
+    /// Two chunks of SPI data, one sent while the other is expanded, with their lengths, and the
+    /// chunk being sent
+    u8 spi[2][LED_STRIP_CHUNK * 3];
+    u16 spi_len[2];
+    u8 sending;
+
+    u8 buf[LED_STRIP_SIZE];
+} LedStrip;
+
+LedStrip led_strip;
+
 typedef enum ExecStatus {
     EXEC_DONE = PORT_READ_CMD,
     EXEC_CONTINUE = PORT_EXEC,
@@ -92,6 +321,15 @@ typedef enum ExecStatus {
 void port_step(PortData* p);
 void port_enable_async_events(PortData *p);
 void port_disable_async_events(PortData *p);
+bool port_async_events_allowed(PortData* p);
+void port_prog_stop(PortData *p);
+void port_adc_stream_stop();
+void port_dac_wave_stop();
+void port_capture_stop(PortData* p);
+void port_pattern_stop();
+void port_counter_stop(PortData* p);
+void port_quad_stop(PortData* p);
+void port_led_strip_release(PortData* p);
 void uart_send_data(PortData *p);
 
 /// Returns true of the specified pin index has interrupt capability
@@ -102,8 +340,9 @@ inline static bool port_pin_supports_interrupt(PortData* p, u8 i) {
 
 /// Initialize the port. Call once on boot.
 void port_init(PortData* p, u8 chan, const TesselPort* port,
-    u8 clock_channel, u8 tcc_channel, DmaChan dma_tx, DmaChan dma_rx) {
+    u8 clock_channel, u8 tcc_channel, u8 tc_channel, DmaChan dma_tx, DmaChan dma_rx) {
     p->tcc_channel = tcc_channel;
+    p->tc_channel = tc_channel;
     p->chan = chan;
     p->port = port;
     p->dma_tx = dma_tx;
@@ -112,6 +351,7 @@ void port_init(PortData* p, u8 chan, const TesselPort* port,
 
     sercom_clock_enable(p->port->spi, p->clock_channel, 1);
     sercom_clock_enable(p->port->uart_i2c, p->clock_channel, 1);
+    timer_clock_enable(p->tc_channel);
 
     bridge_enable_chan(chan);
 }
@@ -119,18 +359,51 @@ void port_init(PortData* p, u8 chan, const TesselPort* port,
 /// Enable the port. Call when switching into a mode where the port will be used.
 /// Resets all port state.
 void port_enable(PortData* p) {
+    p->cmd_head = 0;
+    p->cmd_count = 0;
+    p->cmd_buf = p->cmd_ring[0];
+    p->reply_head = 0;
+    p->reply_count = 0;
+    p->reply_buf = p->reply_ring[0];
     bridge_start_out(p->chan, p->cmd_buf);
     p->pending_in = false;
     p->pending_out = true;
+    p->pending_in_express = false;
     p->cmd_len = 0;
     p->cmd_pos = 0;
     p->reply_len = 0;
+    p->tag_pending = false;
+    p->cmd_tagged = false;
+    p->express_len = 0;
+    p->prog_len = 0;
+    p->prog_running = false;
+    p->prog_due = false;
+    p->prog_active = false;
+    p->prog_held = 0;
+    p->prog_trigger = 0;
+    p->i2c_dma = false;
+    p->i2c_status = REPLY_ACK;
+    p->i2c_failed = false;
+    p->spi_cs = 0;
+    p->spi_cs_hold = false;
+    p->uart_rts = false;
+    p->uart_cts = 0;
+    p->pin_events = 0;
+    p->event_count = 0;
+    p->events_dropped = 0;
+    p->pulse = 0;
+    p->capture_trigger = 0;
+    p->counter = 0;
+    p->quad = 0;
+    p->cmd = CMD_NOP;
     p->state = PORT_READ_CMD;
     p->mode = MODE_NONE;
     NVIC_EnableIRQ(SERCOM0_IRQn + p->port->uart_i2c);
     NVIC_SetPriority(SERCOM0_IRQn + p->port->uart_i2c, 0xff);
     NVIC_EnableIRQ(TCC0_IRQn + p->tcc_channel);
     NVIC_SetPriority(TCC0_IRQn + p->tcc_channel, 0xff);
+    NVIC_EnableIRQ(TC3_IRQn + p->tc_channel - 3);
+    NVIC_SetPriority(TC3_IRQn + p->tc_channel - 3, 0xff);
 
     pin_high(p->port->power);
     for (int i = 0; i<8; i++) {
@@ -138,6 +411,28 @@ void port_enable(PortData* p) {
     }
 }
 
+/// Stop whatever of this port is using its TC: a timed program, an ADC stream, a DAC wave, a
+/// capture, a pattern or an edge counter. Each user of the TC calls this before taking it.
+void port_tc_release(PortData* p) {
+    if (p->prog_running && !p->prog_trigger) {
+        port_prog_stop(p);
+    }
+    if (adc_stream.owner == p) {
+        port_adc_stream_stop();
+    }
+    if (dac_wave.owner == p) {
+        port_dac_wave_stop();
+    }
+    if (logic_capture.owner == p) {
+        port_capture_stop(p);
+        logic_capture.owner = NULL;
+    }
+    if (pattern.owner == p) {
+        port_pattern_stop();
+    }
+    port_counter_stop(p);
+}
+
 /// Disable the port.
 void port_disable(PortData* p) {
     p->state = PORT_DISABLE;
@@ -145,8 +440,20 @@ void port_disable(PortData* p) {
     sercom_reset(p->port->uart_i2c);
     dma_abort(p->dma_tx);
     dma_abort(p->dma_rx);
+    port_prog_stop(p);
+    port_tc_release(p);
+    if (pattern.port == p) {
+        pattern.port = NULL;
+    }
+    port_quad_stop(p);
+    if (led_strip.owner == p) {
+        port_led_strip_release(p);
+    }
 
     port_disable_async_events(p);
+    EIC->INTENCLR.reg = p->pin_events | p->pulse;
+    p->pin_events = 0;
+    p->pulse = 0;
 
     for (int i = 0; i<8; i++) {
         if (port_pin_supports_interrupt(p, i)) {
@@ -164,15 +471,25 @@ void port_disable(PortData* p) {
 
 /// Enqueue a byte on the reply buf. Requires that at least one byte of space is available.
 void port_send_status(PortData* p, u8 d) {
-    if (p->reply_len >= BRIDGE_BUF_SIZE) {
+    // The tagged lookahead points reply_buf at the smaller express_buf
+    u16 size = p->reply_buf == p->express_buf ? PORT_EXPRESS_SIZE : BRIDGE_BUF_SIZE;
+    if (p->reply_len >= size) {
         port_error(p);
         return;
     }
     p->reply_buf[p->reply_len++] = d;
 }
 
-/// Returns the number of argument bytes for the specified command
-int port_cmd_args(PortCmd cmd) {
+/// Enqueue a 32-bit big-endian value on the reply buf
+void port_send_u32(PortData* p, u32 value) {
+    port_send_status(p, value >> 24);
+    port_send_status(p, (value >> 16) & 0xFF);
+    port_send_status(p, (value >> 8) & 0xFF);
+    port_send_status(p, value & 0xFF);
+}
+
+/// Returns the number of argument bytes for the specified command, or -1 if it is unknown
+int port_cmd_arg_len(PortCmd cmd) {
     switch (cmd) {
         case CMD_NOP:
         case CMD_FLUSH:
@@ -188,6 +505,10 @@ int port_cmd_args(PortCmd cmd) {
         case CMD_RX:
         case CMD_TXRX:
             return 1;
+        case CMD_TX_LONG:
+        case CMD_RX_LONG:
+        case CMD_TXRX_LONG:
+            return 2;
 
         // Pin argument:
         case CMD_GPIO_IN:
@@ -221,9 +542,132 @@ int port_cmd_args(PortCmd cmd) {
             return 3; // 1 byte for pin, 2 bytes for duty cycle
         case CMD_PWM_PERIOD:
             return 3; // 1 byte for tcc id & prescalar, 2 bytes for period
+        case CMD_TAG:
+            return 1; // 1 byte for tag
+        case CMD_PROG_LOAD:
+            return 1; // 1 byte for program length
+        case CMD_PROG_RUN:
+            return 6; // 1 byte for prescalar, 2 bytes for period, 2 bytes for count, 1 byte for batch
+        case CMD_PROG_STOP:
+            return 0;
+        case CMD_PROG_TRIGGER:
+            return 4; // 1 byte for pin & mode, 2 bytes for count, 1 byte for batch
+        case CMD_ADC_STREAM_START:
+            return 4; // 1 byte for pin mask, 1 byte for prescalar, 2 bytes for period
+        case CMD_ADC_STREAM_STOP:
+            return 0;
+        case CMD_DAC_WAVE_LOAD:
+            return 2; // 2 bytes for table length in bytes
+        case CMD_DAC_WAVE_PLAY:
+            return 4; // 1 byte for prescalar, 2 bytes for period, 1 byte for flags
+        case CMD_DAC_WAVE_STOP:
+            return 0;
+        case CMD_I2C_READ_REG:
+            return 3; // 1 byte for read length, 1 byte for addr, 1 byte for register
+        case CMD_SPI_CS:
+            return 1; // 1 byte for pin & flags
+        case CMD_UART_FLOW:
+            return 1; // 1 byte for pins & flags
+        case CMD_GPIO_EVENTS:
+            return 1; // 1 byte for flags
+        case CMD_GPIO_PULSE:
+            return 3; // 1 byte for pin & mode, 2 bytes for timeout in ms
+        case CMD_CAPTURE_TRIGGER:
+            return 3; // 1 byte for pin & mode, 2 bytes for timeout in ms
+        case CMD_CAPTURE:
+            return 5; // 1 byte for prescalar, 2 bytes for period, 2 bytes for sample count
+        case CMD_PATTERN_LOAD:
+            return 3; // 1 byte for pin mask, 2 bytes for step count
+        case CMD_PATTERN_PLAY:
+            return 4; // 1 byte for prescalar, 2 bytes for period, 1 byte for flags
+        case CMD_PATTERN_STOP:
+            return 0;
+        case CMD_COUNTER_START:
+            return 1; // 1 byte for pin & mode
+        case CMD_QUAD_START:
+            return 1; // 1 byte for pins & flags
+        case CMD_LED_STRIP:
+            return 2; // 2 bytes for frame length in bytes
+        case CMD_COUNTER_READ:
+        case CMD_QUAD_READ:
+        case CMD_GPIO_READ_ALL:
+            return 0;
+        case CMD_GPIO_WRITE_MASK:
+        case CMD_GPIO_DIR_MASK:
+            return 2; // 1 byte for mask, 1 byte for levels or directions
+        case CMD_I2C_STATUS:
+        case CMD_I2C_SCAN:
+        case CMD_UART_STATUS:
+            return 0;
+    }
+    return -1;
+}
+
+/// Returns true if the command exists
+bool port_cmd_known(PortCmd cmd) {
+    return port_cmd_arg_len(cmd) >= 0;
+}
+
+/// Returns the number of argument bytes for the specified command
+int port_cmd_args(PortCmd cmd) {
+    int len = port_cmd_arg_len(cmd);
+    if (len < 0) {
+        invalid();
+        return 0;
+    }
+    return len;
+}
+
+/// Returns true if the command sends a reply. Tagged commands that don't are acknowledged with
+/// REPLY_ACK when they complete.
+bool port_cmd_has_reply(PortCmd cmd) {
+    switch (cmd) {
+        case CMD_ECHO:
+        case CMD_RX:
+        case CMD_TXRX:
+        case CMD_RX_LONG:
+        case CMD_TXRX_LONG:
+        case CMD_GPIO_IN:
+        case CMD_GPIO_RAW_READ:
+        case CMD_ANALOG_READ:
+        case CMD_I2C_READ_REG:
+        case CMD_I2C_STATUS:
+        case CMD_I2C_SCAN:
+        case CMD_UART_STATUS:
+        case CMD_GPIO_READ_ALL:
+        case CMD_GPIO_PULSE:
+        case CMD_CAPTURE:
+        case CMD_COUNTER_READ:
+        case CMD_QUAD_READ:
+            return true;
+        default:
+            return false;
+    }
+}
+
+/// Returns true if a tagged command may execute while another command is in progress: it has
+/// no payload, completes immediately, and does not use the port's SERCOM.
+bool port_cmd_is_immediate(PortCmd cmd) {
+    switch (cmd) {
+        case CMD_GPIO_IN:
+        case CMD_GPIO_HIGH:
+        case CMD_GPIO_LOW:
+        case CMD_GPIO_TOGGLE:
+        case CMD_GPIO_PULL:
+        case CMD_GPIO_INPUT:
+        case CMD_GPIO_RAW_READ:
+        case CMD_ANALOG_READ:
+        case CMD_ANALOG_WRITE:
+        case CMD_PWM_DUTY_CYCLE:
+        case CMD_GPIO_READ_ALL:
+        case CMD_GPIO_WRITE_MASK:
+        case CMD_GPIO_DIR_MASK:
+        case CMD_COUNTER_READ:
+        case CMD_QUAD_READ:
+            return true;
+        default:
+            return false;
     }
-    invalid();
-    return 0;
 }
 
 /// Calculate the number of bytes that can immediately be processed for a TX command
@@ -265,6 +709,40 @@ Pin port_selected_pin(PortData* p) {
     return p->port->gpio[p->arg[0] % 8];
 }
 
+/// Read the levels of the port's pins, pin n in bit n
+u8 port_gpio_read_all(PortData* p) {
+    u32 in[2] = {PORT->Group[0].IN.reg, PORT->Group[1].IN.reg};
+    u8 levels = 0;
+    for (int i = 0; i<8; i++) {
+        Pin pin = p->port->gpio[i];
+        if (in[pin.group] & (1 << pin.pin)) {
+            levels |= 1 << i;
+        }
+    }
+    return levels;
+}
+
+/// Write the levels of the pins in mask, with one OUTSET and one OUTCLR per PORT group so that the
+/// pins of a group change together
+void port_gpio_write_mask(PortData* p, u8 mask, u8 levels) {
+    u32 set[2] = {0, 0};
+    u32 clr[2] = {0, 0};
+    for (int i = 0; i<8; i++) {
+        if (mask & (1 << i)) {
+            Pin pin = p->port->gpio[i];
+            if (levels & (1 << i)) {
+                set[pin.group] |= 1 << pin.pin;
+            } else {
+                clr[pin.group] |= 1 << pin.pin;
+            }
+        }
+    }
+    for (int g = 0; g<2; g++) {
+        PORT->Group[g].OUTSET.reg = set[g];
+        PORT->Group[g].OUTCLR.reg = clr[g];
+    }
+}
+
 /// Complete an asynchronous command and begin the next command.
 void port_exec_async_complete(PortData* p, ExecStatus s) {
     if (p->state != PORT_EXEC_ASYNC) {
@@ -275,54 +753,1624 @@ void port_exec_async_complete(PortData* p, ExecStatus s) {
     port_step(p);
 }
 
-/// Flush pending received UART data to the reply buffer
-void uart_send_data(PortData *p){
-    if (p->uart_buf.buf_len > 0) {
-        // pad 2 bytes at the beginning
-        // 1st byte indicates uart rx
-        // 2nd byte indicates uart rx number.
-        // this also means rx number has to be <255
-        u8 count = p->uart_buf.buf_len;
+/// Check a program received by CMD_PROG_LOAD and compute the largest reply of one iteration.
+/// Programs contain complete commands with their payloads, and may not manage programs or tags.
+bool port_prog_validate(PortData* p) {
+    u16 pos = 0;
+    u16 reply_size = 0;
+    while (pos < p->prog_len) {
+        u8 cmd = p->prog_buf[pos++];
+        if (!port_cmd_known(cmd)) {
+            return false;
+        }
+        u8 arg_len = port_cmd_args(cmd);
+        if (pos + arg_len > p->prog_len) {
+            return false;
+        }
+        u8 len = arg_len > 0 ? p->prog_buf[pos] : 0;
+        pos += arg_len;
+
+        switch (cmd) {
+            case CMD_TAG:
+            case CMD_PROG_LOAD:
+            case CMD_PROG_RUN:
+            case CMD_PROG_STOP:
+            case CMD_PROG_TRIGGER:
+            case CMD_ADC_STREAM_START:
+            case CMD_ADC_STREAM_STOP:
+            case CMD_DAC_WAVE_LOAD:
+            case CMD_DAC_WAVE_PLAY:
+            case CMD_DAC_WAVE_STOP:
+            case CMD_TX_LONG:
+            case CMD_RX_LONG:
+            case CMD_TXRX_LONG:
+            case CMD_GPIO_EVENTS:
+            case CMD_CAPTURE_TRIGGER:
+            case CMD_CAPTURE:
+            case CMD_PATTERN_LOAD:
+            case CMD_PATTERN_PLAY:
+            case CMD_PATTERN_STOP:
+            case CMD_COUNTER_START:
+            case CMD_QUAD_START:
+            case CMD_LED_STRIP:
+                return false;
+            case CMD_ECHO:
+            case CMD_TXRX:
+                pos += len;
+                reply_size += 1 + len;
+                break;
+            case CMD_TX:
+                pos += len;
+                break;
+            case CMD_RX:
+            case CMD_I2C_READ_REG:
+                reply_size += 1 + len;
+                break;
+            case CMD_ANALOG_READ:
+                reply_size += 3;
+                break;
+            case CMD_GPIO_IN:
+            case CMD_GPIO_RAW_READ:
+            case CMD_I2C_STATUS:
+                reply_size += 1;
+                break;
+            case CMD_I2C_SCAN:
+                reply_size += 1 + I2C_SCAN_SIZE;
+                break;
+            case CMD_UART_STATUS:
+            case CMD_GPIO_PULSE:
+            case CMD_QUAD_READ:
+                reply_size += 5;
+                break;
+            case CMD_COUNTER_READ:
+                reply_size += 9;
+                break;
+            case CMD_GPIO_READ_ALL:
+                reply_size += 2;
+                break;
+        }
+    }
+    if (pos > p->prog_len
+       || PORT_PROG_FRAME_HEADER + reply_size + PORT_REPLY_RESERVE > BRIDGE_BUF_SIZE) {
+        return false;
+    }
+    p->prog_reply_size = reply_size;
+    return true;
+}
+
+/// Stop the port's TC, which is used by one of a timed program, the ADC stream, and DAC playback
+void port_timer_stop(PortData* p) {
+    tc(p->tc_channel)->COUNT16.INTENCLR.reg = TC_INTENSET_OVF;
+    tc(p->tc_channel)->COUNT16.CTRLA.bit.ENABLE = 0;
+    while (tc(p->tc_channel)->COUNT16.STATUS.bit.SYNCBUSY);
+}
+
+/// Start the port's TC overflowing every period + 1 prescaled ticks, with the passed event outputs
+void port_timer_start(PortData* p, u8 prescalar, u16 period, u16 evctrl) {
+    port_timer_stop(p);
+    tc(p->tc_channel)->COUNT16.CTRLA.reg
+        = TC_CTRLA_WAVEGEN_MFRQ
+        | TC_CTRLA_PRESCALER(prescalar);
+    tc(p->tc_channel)->COUNT16.EVCTRL.reg = evctrl;
+    tc(p->tc_channel)->COUNT16.COUNT.reg = 0;
+    tc(p->tc_channel)->COUNT16.CC[0].reg = period;
+    while (tc(p->tc_channel)->COUNT16.STATUS.bit.SYNCBUSY);
+
+    tc(p->tc_channel)->COUNT16.INTFLAG.reg = TC_INTFLAG_OVF;
+    tc(p->tc_channel)->COUNT16.CTRLA.bit.ENABLE = 1;
+}
+
+/// Schedule count iterations of the stored program (0 to run until stopped), sending their
+/// replies batch iterations at a time
+void port_prog_start(PortData* p, u16 count, u8 batch) {
+    port_prog_stop(p);
+    p->prog_remaining = count;
+    p->prog_forever = count == 0;
+    p->prog_batch = batch > 0 ? batch : 1;
+    p->prog_batched = 0;
+    p->prog_running = true;
+}
+
+/// Start running the stored program every timer period
+void port_prog_run(PortData* p) {
+    if (p->prog_len == 0) {
+        return;
+    }
+
+    port_tc_release(p);
+    port_prog_start(p, (p->arg[3] << 8) + p->arg[4], p->arg[5]);
+
+    // The first iteration starts immediately
+    p->prog_due = true;
+
+    port_timer_start(p, p->arg[0] & 0x7, (p->arg[1] << 8) + p->arg[2], 0);
+    tc(p->tc_channel)->COUNT16.INTENSET.reg = TC_INTENSET_OVF;
+}
+
+/// Start running the stored program on each interrupt of a pin, e.g. a sensor's data-ready line.
+/// The pin is reserved for the trigger and does not send pin change events.
+void port_prog_trigger(PortData* p) {
+    u8 pin = p->arg[0] & 0x7;
+    u8 mode = (p->arg[0] >> 4) & 0x07;
+    if (p->prog_len == 0 || mode == 0 || !port_pin_supports_interrupt(p, pin)) {
+        return;
+    }
+
+    port_prog_start(p, (p->arg[1] << 8) + p->arg[2], p->arg[3]);
+
+    Pin sys_pin = p->port->gpio[pin];
+    p->prog_trigger_pin = pin;
+    p->prog_trigger = 1 << pin_extint(sys_pin);
+    pin_mux_eic(sys_pin);
+    eic_config(sys_pin, mode);
+    EIC->INTFLAG.reg = p->prog_trigger;
+    EIC->INTENSET.reg = p->prog_trigger;
+}
+
+/// Stop scheduling program iterations. Replies held for the batch are released.
+void port_prog_stop(PortData* p) {
+    if (p->prog_trigger) {
+        EIC->INTENCLR.reg = p->prog_trigger;
+        eic_config(p->port->gpio[p->prog_trigger_pin], EIC_CONFIG_SENSE_NONE);
+        pin_gpio(p->port->gpio[p->prog_trigger_pin]);
+        EIC->INTFLAG.reg = p->prog_trigger;
+        p->prog_trigger = 0;
+    } else if (p->prog_running) {
+        port_timer_stop(p);
+    }
+    p->prog_running = false;
+    p->prog_due = false;
+    p->prog_held = 0;
+}
+
+/// Start sampling the pins in the mask arg[0] in turn, one conversion each period of the port's TC.
+/// The TC starts the ADC through EVSYS, DMA_ADC_RESULT copies each result into a double buffer,
+/// and the ADC's RESRDY event triggers DMA_ADC_SEQ to select the next pin.
+void port_adc_stream_start(PortData* p) {
+    u8 mask = p->arg[0];
+    if (mask == 0) {
+        return;
+    }
+
+    port_adc_stream_stop();
+    port_tc_release(p);
+
+    u32 inputctrl[8];
+    u8 count = 0;
+    for (int i = 0; i<8; i++) {
+        if (mask & (1 << i)) {
+            Pin pin = p->port->gpio[i];
+            pin_analog(pin);
+            inputctrl[count++] = ADC_INPUTCTRL_MUXPOS(pin.chan)
+                               | ADC_INPUTCTRL_MUXNEG_GND
+                               | ADC_INPUTCTRL_GAIN_DIV2;
+        }
+    }
+    for (int i = 0; i<count; i++) {
+        adc_stream.seq[i] = inputctrl[(i + 1) % count];
+    }
+
+    adc_stream.owner = p;
+    adc_stream.block = ADC_STREAM_BLOCK / count * count;
+    adc_stream.filling = 0;
+    adc_stream.ready = false;
+    adc_stream.overrun = false;
+
+    adc_stream_enable(inputctrl[0]);
+
+    // Results alternate between the halves of buf
+    dma_adc_configure_result(DMA_ADC_RESULT);
+    dma_fill_adc_result(&adc_stream_result_desc[0], adc_stream.buf[0], adc_stream.block);
+    dma_fill_adc_result(&adc_stream_result_desc[1], adc_stream.buf[1], adc_stream.block);
+    adc_stream_result_desc[0].DESCADDR.reg = (unsigned) &adc_stream_result_desc[1];
+    adc_stream_result_desc[1].DESCADDR.reg = (unsigned) &adc_stream_result_desc[0];
+    dma_enable_interrupt(DMA_ADC_RESULT);
+    dma_start_descriptor(DMA_ADC_RESULT, adc_stream_result_desc);
+
+    // The channel sequence repeats
+    dma_event_configure(DMA_ADC_SEQ);
+    adc_stream_seq_desc.SRCADDR.reg = (unsigned) &adc_stream.seq[count];
+    adc_stream_seq_desc.DSTADDR.reg = (unsigned) &ADC->INPUTCTRL.reg;
+    adc_stream_seq_desc.BTCNT.reg = count;
+    adc_stream_seq_desc.BTCTRL.reg = DMAC_BTCTRL_VALID | DMAC_BTCTRL_BEATSIZE_WORD | DMAC_BTCTRL_SRCINC;
+    adc_stream_seq_desc.DESCADDR.reg = (unsigned) &adc_stream_seq_desc;
+    dma_start_descriptor(DMA_ADC_SEQ, &adc_stream_seq_desc);
+
+    evsys_config(EVSYS_ADC_RESRDY, EVSYS_ID_GEN_ADC_RESRDY, EVSYS_ID_USER_DMAC_CH_0 + DMA_ADC_SEQ);
+    evsys_config(EVSYS_ADC_START, EVSYS_ID_GEN_TC3_OVF + (p->tc_channel - 3) * 3,
+        EVSYS_ID_USER_ADC_START);
+
+    port_timer_start(p, p->arg[1] & 0x7, (p->arg[2] << 8) + p->arg[3], TC_EVCTRL_OVFEO);
+}
+
+/// Stop the ADC stream, dropping samples that haven't been sent
+void port_adc_stream_stop() {
+    if (adc_stream.owner == NULL) {
+        return;
+    }
+
+    port_timer_stop(adc_stream.owner);
+    EVSYS->USER.reg = EVSYS_USER_CHANNEL(0) | EVSYS_USER_USER(EVSYS_ID_USER_ADC_START);
+    EVSYS->USER.reg = EVSYS_USER_CHANNEL(0) | EVSYS_USER_USER(EVSYS_ID_USER_DMAC_CH_0 + DMA_ADC_SEQ);
+    dma_abort(DMA_ADC_RESULT);
+    dma_abort(DMA_ADC_SEQ);
+    adc_stream_disable();
+    adc_stream.owner = NULL;
+    adc_stream.ready = false;
+}
+
+void port_adc_stream_completion() {
+    PortData* p = adc_stream.owner;
+    if (p == NULL) {
+        return;
+    }
+
+    // DMA has moved on to the other half, so a block still waiting there is lost
+    if (adc_stream.ready) {
+        adc_stream.overrun = true;
+    }
+    adc_stream.ready = true;
+    adc_stream.filling ^= 1;
+
+    if (port_async_events_allowed(p)) {
+        port_step(p);
+    }
+}
+
+/// Returns true if the port owns the ADC stream and has room in reply_buf for its ready block
+bool port_adc_stream_pending(PortData* p) {
+    return adc_stream.owner == p && adc_stream.ready
+        && p->reply_len + 4 + adc_stream.block * 2 + PORT_REPLY_RESERVE <= BRIDGE_BUF_SIZE;
+}
+
+/// Copy the ready block of ADC samples to the reply buffer
+void port_adc_stream_send(PortData* p) {
+    if (adc_stream.overrun) {
+        port_send_status(p, REPLY_ASYNC_ADC_OVERRUN);
+        adc_stream.overrun = false;
+    }
+
+    u16 len = adc_stream.block * 2;
+    p->reply_buf[p->reply_len++] = REPLY_ASYNC_ADC_DATA;
+    p->reply_buf[p->reply_len++] = len >> 8;
+    p->reply_buf[p->reply_len++] = len & 0xFF;
+    memcpy(&p->reply_buf[p->reply_len], adc_stream.buf[adc_stream.filling ^ 1], len);
+    p->reply_len += len;
+    adc_stream.ready = false;
+}
+
+/// Start a CMD_DAC_WAVE_LOAD of arg[0..1] bytes of little-endian samples, stopping playback
+bool port_dac_wave_load(PortData* p) {
+    u16 size = (p->arg[0] << 8) + p->arg[1];
+    port_dac_wave_stop();
+    dac_wave.len = 0;
+    dac_wave.loaded = 0;
+    if (size > sizeof(dac_wave.buf) || size % 2 != 0) {
+        port_error(p);
+        return false;
+    }
+    return size > 0;
+}
+
+/// Play the loaded table on the DAC, one sample each period of the port's TC. The TC's overflow
+/// event moves the DAC's buffered sample to its output, and the emptied buffer triggers
+/// DMA_DAC_WAVE to copy the next sample. With FLAG_DAC_WAVE_LOOP the table repeats until
+/// stopped; otherwise the output holds the last sample and REPLY_ASYNC_DAC_WAVE_END is sent.
+void port_dac_wave_play(PortData* p) {
+    if (dac_wave.len == 0) {
+        return;
+    }
+
+    port_dac_wave_stop();
+    port_tc_release(p);
+
+    dac_wave.owner = p;
+    dac_wave.ended = false;
+
+    dac_stream_enable(PORT_B.g3);
+
+    dma_dac_configure(DMA_DAC_WAVE);
+    dma_fill_dac(&dac_wave_desc, dac_wave.buf, dac_wave.len);
+    dac_wave_desc.DESCADDR.reg = (p->arg[3] & FLAG_DAC_WAVE_LOOP) ? (unsigned) &dac_wave_desc : 0;
+    dma_enable_interrupt(DMA_DAC_WAVE);
+    dma_start_descriptor(DMA_DAC_WAVE, &dac_wave_desc);
+
+    evsys_config(EVSYS_DAC_START, EVSYS_ID_GEN_TC3_OVF + (p->tc_channel - 3) * 3,
+        EVSYS_ID_USER_DAC_START);
+
+    port_timer_start(p, p->arg[0] & 0x7, (p->arg[1] << 8) + p->arg[2], TC_EVCTRL_OVFEO);
+}
+
+/// Stop DAC playback. The output holds the last sample written.
+void port_dac_wave_stop() {
+    if (dac_wave.owner == NULL) {
+        return;
+    }
+
+    port_timer_stop(dac_wave.owner);
+    EVSYS->USER.reg = EVSYS_USER_CHANNEL(0) | EVSYS_USER_USER(EVSYS_ID_USER_DAC_START);
+    dma_abort(DMA_DAC_WAVE);
+    dac_stream_disable();
+    dac_wave.owner = NULL;
+    dac_wave.ended = false;
+}
+
+/// Called when DMA_DAC_WAVE has copied the last sample of one-shot playback
+void port_dac_wave_completion() {
+    PortData* p = dac_wave.owner;
+    if (p == NULL) {
+        return;
+    }
+
+    dac_wave.ended = true;
+    if (port_async_events_allowed(p)) {
+        port_step(p);
+    }
+}
+
+/// Returns true if the port's one-shot DAC playback has ended and the reply has room
+bool port_dac_wave_pending(PortData* p) {
+    return dac_wave.owner == p && dac_wave.ended && p->reply_len + 1 <= BRIDGE_BUF_SIZE;
+}
+
+/// Finish one-shot playback, outputting the last sample in case its TC event hasn't come yet
+void port_dac_wave_send_end(PortData* p) {
+    port_dac_wave_stop();
+    DAC->DATA.reg = dac_wave.buf[dac_wave.len - 1];
+    port_send_status(p, REPLY_ASYNC_DAC_WAVE_END);
+}
+
+/// Start or stop recording the port's pin interrupts as timestamped events. While recording,
+/// their EIC interrupts stay enabled, so that edges are timed even while a command is executing.
+void port_pin_events(PortData* p) {
+    u32 flags = p->port->pin_interrupts
+              & ~(p->prog_trigger | p->uart_cts | p->pulse | p->counter | p->quad);
+    if (p->arg[0] & FLAG_GPIO_EVENTS_ENABLE) {
+        // Edges latched while the interrupts were disabled happened at an unknown time
+        EIC->INTFLAG.reg = flags & ~p->pin_events;
+        p->pin_events = flags;
+        EIC->INTENSET.reg = flags;
+    } else {
+        EIC->INTENCLR.reg = p->pin_events;
+        p->pin_events = 0;
+    }
+}
+
+/// Record an event for each pin with an interrupt flag set in flags, at the current time
+void port_pin_events_record(PortData* p, u32 flags) {
+    u32 time = timestamp_us();
+    EIC->INTFLAG.reg = flags;
+
+    for (int pin = 0; pin<8; pin++) {
+        if (!port_pin_supports_interrupt(p, pin)) continue;
+        Pin sys_pin = p->port->gpio[pin];
+        if (!(flags & (1 << pin_extint(sys_pin)))) continue;
+
+        // The level is known from the sense of all but "change" interrupts, which read it back
+        u8 sense = eic_read_config(sys_pin);
+        bool level = sense == EIC_CONFIG_SENSE_RISE || sense == EIC_CONFIG_SENSE_HIGH
+            || (sense == EIC_CONFIG_SENSE_BOTH && pin_read(sys_pin));
+        if (sense & EIC_CONFIG_SENSE_LEVEL) {
+            // Level interrupts only trigger once
+            eic_config(sys_pin, EIC_CONFIG_SENSE_NONE);
+        }
+
+        if (p->event_count == PIN_EVENTS_SIZE) {
+            if (p->events_dropped < 0xFFFF) {
+                p->events_dropped++;
+            }
+            continue;
+        }
+        u8 slot = (p->event_head + p->event_count) % PIN_EVENTS_SIZE;
+        p->event_pin[slot] = pin | (level << 3);
+        p->event_time[slot] = time;
+        p->event_count++;
+    }
+}
+
+/// Returns true if recorded events should be sent. While a reply is on its way to the host,
+/// events are held so that a burst of edges is sent in one frame, unless the ring is filling up.
+bool port_pin_events_pending(PortData* p) {
+    if (p->event_count == 0 && p->events_dropped == 0) return false;
+    if (p->pending_in && p->event_count < PIN_EVENTS_SIZE / 2) return false;
+    return p->reply_len + 4 + PIN_EVENTS_SIZE * PIN_EVENT_SIZE + PORT_REPLY_RESERVE
+        <= BRIDGE_BUF_SIZE;
+}
+
+/// Copy the recorded events to the reply buffer in a REPLY_ASYNC_PIN_EVENTS frame
+void port_pin_events_send(PortData* p) {
+    port_send_status(p, REPLY_ASYNC_PIN_EVENTS);
+    port_send_status(p, p->event_count);
+    port_send_status(p, p->events_dropped >> 8);
+    port_send_status(p, p->events_dropped & 0xFF);
+    p->events_dropped = 0;
+
+    while (p->event_count > 0) {
+        u32 time = p->event_time[p->event_head];
+        port_send_status(p, p->event_pin[p->event_head]);
+        port_send_status(p, time >> 24);
+        port_send_status(p, (time >> 16) & 0xFF);
+        port_send_status(p, (time >> 8) & 0xFF);
+        port_send_status(p, time & 0xFF);
+        p->event_head = (p->event_head + 1) % PIN_EVENTS_SIZE;
+        p->event_count--;
+    }
+}
+
+/// Start measuring a pulse for CMD_GPIO_PULSE. Returns false if the pin can't interrupt.
+bool port_pulse_begin(PortData* p) {
+    u8 pin = p->arg[0] & 0x7;
+    u8 mode = (p->arg[0] >> 4) & 0x3;
+    if (!port_pin_supports_interrupt(p, pin) || mode > PULSE_PERIOD) {
+        return false;
+    }
+
+    Pin sys_pin = p->port->gpio[pin];
+    p->pulse_pin = pin;
+    p->pulse = 1 << pin_extint(sys_pin);
+    p->pulse_started = false;
+    p->pulse_end = mode == PULSE_HIGH ? EIC_CONFIG_SENSE_FALL : EIC_CONFIG_SENSE_RISE;
+    // The first millisecond tick may come right away
+    p->pulse_timeout = (p->arg[1] << 8) + p->arg[2] + 1;
+
+    pin_mux_eic(sys_pin);
+    eic_config(sys_pin, mode == PULSE_LOW ? EIC_CONFIG_SENSE_FALL : EIC_CONFIG_SENSE_RISE);
+    EIC->INTFLAG.reg = p->pulse;
+    EIC->INTENSET.reg = p->pulse;
+    return true;
+}
+
+/// Stop measuring, and reply with the length of the pulse in microseconds or REPLY_TIMEOUT
+void port_pulse_finish(PortData* p, bool measured, u32 length) {
+    Pin sys_pin = p->port->gpio[p->pulse_pin];
+    eic_config(sys_pin, EIC_CONFIG_SENSE_NONE);
+    pin_gpio(sys_pin);
+    EIC->INTENCLR.reg = p->pulse & ~p->pin_events;
+    p->pulse = 0;
+
+    if (measured) {
+        port_send_status(p, REPLY_DATA);
+        port_send_status(p, length >> 24);
+        port_send_status(p, (length >> 16) & 0xFF);
+        port_send_status(p, (length >> 8) & 0xFF);
+        port_send_status(p, length & 0xFF);
+    } else {
+        port_send_status(p, REPLY_TIMEOUT);
+    }
+    port_exec_async_complete(p, EXEC_DONE);
+}
+
+/// Handle an edge of the pin being measured: the start of the pulse, then its end
+void port_pulse_edge(PortData* p) {
+    u32 time = timestamp_us();
+    if (p->pulse_started) {
+        port_pulse_finish(p, true, time - p->pulse_start);
+        return;
+    }
+
+    p->pulse_started = true;
+    p->pulse_start = time;
+    eic_config(p->port->gpio[p->pulse_pin], p->pulse_end);
+}
+
+/// Find the bytes of the PORT registers that hold the port's pins, so that DMA transfers as few
+/// as possible for each step. Returns the number of bytes per step.
+u8 port_pin_lanes(PortData* p, PinLanes* l) {
+    u8 total = 0;
+    l->count = 0;
+    for (u8 group = 0; group < 2; group++) {
+        u32 bits = 0;
+        for (int i = 0; i<8; i++) {
+            if (p->port->gpio[i].group == group) {
+                bits |= 1 << p->port->gpio[i].pin;
+            }
+        }
+        if (bits == 0) continue;
+
+        // A byte, an aligned halfword, or the whole register
+        u8 first = __builtin_ctz(bits) / 8;
+        u8 last = (31 - __builtin_clz(bits)) / 8;
+        u8 offset = 0;
+        u8 size = 4;
+        if (first == last) {
+            offset = first;
+            size = 1;
+        } else if (first / 2 == last / 2) {
+            offset = first & ~1;
+            size = 2;
+        }
+
+        u8 lane = l->count++;
+        l->group[lane] = group;
+        l->offset[lane] = offset;
+        l->size[lane] = size;
+        for (int i = 0; i<8; i++) {
+            if (p->port->gpio[i].group == group) {
+                l->pin_lane[i] = lane;
+                l->pin_bit[i] = p->port->gpio[i].pin - offset * 8;
+            }
+        }
+        total += size;
+    }
+    return total;
+}
+
+/// Returns the DMA channel that transfers a lane for the port's TC
+inline static DmaChan port_lane_chan(PortData* p, u8 lane) {
+    return lane == 0 ? p->dma_rx : p->dma_tx;
+}
+
+/// Configure a lane's DMA channel to transfer a beat on each overflow of the port's TC for the
+/// first lane, and on each compare match one tick before it for the second
+void port_lane_configure(PortData* p, u8 lane) {
+    u8 trigsrc = TC3_DMAC_ID_OVF + (p->tc_channel - 3) * 3;
+    dma_trigger_configure(port_lane_chan(p, lane), lane == 0 ? trigsrc : trigsrc + 2);
+}
+
+/// Set up the port's TC to pace lane transfers, stopped so that their DMA can be started first
+void port_timer_prepare_lanes(PortData* p, u8 prescalar, u16 period, u16 evctrl) {
+    port_timer_start(p, prescalar, period, evctrl);
+    tc(p->tc_channel)->COUNT16.CTRLBSET.reg = TC_CTRLBSET_CMD_STOP;
+    while (tc(p->tc_channel)->COUNT16.STATUS.bit.SYNCBUSY);
+    tc(p->tc_channel)->COUNT16.COUNT.reg = 0;
+    tc(p->tc_channel)->COUNT16.CC[1].reg = period;
+    while (tc(p->tc_channel)->COUNT16.STATUS.bit.SYNCBUSY);
+    tc(p->tc_channel)->COUNT16.INTFLAG.reg = TC_INTFLAG_OVF | TC_INTFLAG_MC1;
+}
+
+/// Start a logic analyzer capture for CMD_CAPTURE. Each overflow of the port's TC makes its DMA
+/// channels copy the PORT IN registers, so the port's SERCOM must not be in use. Returns false if
+/// the capture can't start.
+bool port_capture_begin(PortData* p) {
+    LogicCapture* c = &logic_capture;
+    u16 count = (p->arg[3] << 8) + p->arg[4];
+    if (c->owner != NULL || p->mode != MODE_NONE || count == 0
+       || count > CAPTURE_SIZE / port_pin_lanes(p, &c->lanes)) {
+        return false;
+    }
+
+    port_tc_release(p);
+
+    c->owner = p;
+    c->count = count;
+    c->trigger = 0;
+    c->waiting = false;
+
+    u8 pin = p->capture_trigger & 0x7;
+    u8 mode = (p->capture_trigger >> 4) & 0x7;
+    bool triggered = mode != 0 && port_pin_supports_interrupt(p, pin);
+    u16 period = (p->arg[1] << 8) + p->arg[2];
+
+    // The TC is stopped until the trigger's event or a retrigger command starts it
+    port_timer_prepare_lanes(p, p->arg[0] & 0x7, period,
+        triggered ? TC_EVCTRL_TCEI | TC_EVCTRL_EVACT_START : 0);
+
+    PinLanes* l = &c->lanes;
+    u8* dst = c->buf;
+    for (u8 lane = 0; lane < l->count; lane++) {
+        DmacDescriptor desc;
+        l->buf[lane] = dst;
+        port_lane_configure(p, lane);
+        dma_fill_register_read(&desc, (volatile u8*) &PORT->Group[l->group[lane]].IN.reg + l->offset[lane],
+            l->size[lane], dst, count);
+        dma_start_descriptor(port_lane_chan(p, lane), &desc);
+        dst += count * l->size[lane];
+    }
+    dma_enable_interrupt(p->dma_rx);
+
+    if (triggered) {
+        Pin sys_pin = p->port->gpio[pin];
+        c->trigger = 1 << pin_extint(sys_pin);
+        c->waiting = true;
+        // The first millisecond tick may come right away
+        c->timeout = p->capture_timeout + 1;
+
+        EIC->INTENCLR.reg = c->trigger;
+        pin_mux_eic(sys_pin);
+        eic_config(sys_pin, mode);
+        evsys_config(EVSYS_CAPTURE_START, EVSYS_ID_GEN_EIC_EXTINT_0 + pin_extint(sys_pin),
+            EVSYS_ID_USER_TC3_EVU + p->tc_channel - 3);
+        EIC->EVCTRL.reg |= c->trigger;
+    } else {
+        tc(p->tc_channel)->COUNT16.CTRLBSET.reg = TC_CTRLBSET_CMD_RETRIGGER;
+    }
+    return true;
+}
+
+/// Stop sampling and release the trigger pin. The samples stay in the buffer until sent.
+void port_capture_stop(PortData* p) {
+    LogicCapture* c = &logic_capture;
+    port_timer_stop(p);
+    dma_abort(p->dma_rx);
+    dma_abort(p->dma_tx);
+
+    if (c->trigger) {
+        Pin sys_pin = p->port->gpio[p->capture_trigger & 0x7];
+        EIC->EVCTRL.reg &= ~c->trigger;
+        EVSYS->USER.reg = EVSYS_USER_CHANNEL(0) | EVSYS_USER_USER(EVSYS_ID_USER_TC3_EVU + p->tc_channel - 3);
+        eic_config(sys_pin, EIC_CONFIG_SENSE_NONE);
+        pin_gpio(sys_pin);
+        EIC->INTFLAG.reg = c->trigger;
+        c->trigger = 0;
+    }
+    c->waiting = false;
+}
+
+/// Called when the first lane's DMA has copied the last sample
+void port_capture_completion(PortData* p) {
+    port_capture_stop(p);
+    logic_capture.sent = 0;
+    port_send_status(p, REPLY_DATA);
+    port_exec_async_complete(p, EXEC_CONTINUE);
+}
+
+/// Copy as many samples as fit to reply_buf, one byte each with pin n in bit n. Returns true
+/// when all have been sent.
+bool port_capture_send(PortData* p) {
+    LogicCapture* c = &logic_capture;
+    u32 size = c->count - c->sent;
+    if (size > BRIDGE_BUF_SIZE - p->reply_len) {
+        size = BRIDGE_BUF_SIZE - p->reply_len;
+    }
+
+    for (u32 n = c->sent; n < c->sent + size; n++) {
+        PinLanes* l = &c->lanes;
+        u32 lane_value[2] = {0, 0};
+        for (u8 lane = 0; lane < l->count; lane++) {
+            memcpy(&lane_value[lane], &l->buf[lane][n * l->size[lane]], l->size[lane]);
+        }
+
+        u8 sample = 0;
+        for (int i = 0; i<8; i++) {
+            sample |= ((lane_value[l->pin_lane[i]] >> l->pin_bit[i]) & 1) << i;
+        }
+        p->reply_buf[p->reply_len++] = sample;
+    }
+    c->sent += size;
+
+    if (c->sent < c->count) {
+        return false;
+    }
+    c->owner = NULL;
+    return true;
+}
+
+/// Store the toggles of the pattern's pins from step a to step b at a step of each lane
+void port_pattern_store(u16 step, u8 a, u8 b) {
+    PinLanes* l = &pattern.lanes;
+    u8 toggle = (a ^ b) & pattern.mask;
+    u32 lane_value[2] = {0, 0};
+    for (int i = 0; i<8; i++) {
+        if (toggle & (1 << i)) {
+            lane_value[l->pin_lane[i]] |= 1 << l->pin_bit[i];
+        }
+    }
+    for (u8 lane = 0; lane < l->count; lane++) {
+        memcpy(&l->buf[lane][step * l->size[lane]], &lane_value[lane], l->size[lane]);
+    }
+}
+
+/// Start a CMD_PATTERN_LOAD of arg[1..2] steps for the pins in the mask arg[0], stopping playback
+bool port_pattern_load(PortData* p) {
+    u16 len = (p->arg[1] << 8) + p->arg[2];
+    port_pattern_stop();
+    pattern.port = p;
+    pattern.mask = p->arg[0];
+    pattern.len = 0;
+    pattern.loaded = 0;
+
+    u8 size = port_pin_lanes(p, &pattern.lanes);
+    if (len * size > PATTERN_SIZE) {
+        pattern.port = NULL;
+        port_error(p);
+        return false;
+    }
+
+    u8* dst = pattern.buf;
+    for (u8 lane = 0; lane < pattern.lanes.count; lane++) {
+        pattern.lanes.buf[lane] = dst;
+        dst += len * pattern.lanes.size[lane];
+    }
+    return len > 0;
+}
+
+/// Receive steps of CMD_PATTERN_LOAD, one byte each with the level of pin n in bit n. The table
+/// holds the changes between steps, so that DMA can write them to OUTTGL without disturbing the
+/// other pins of the PORT groups.
+ExecStatus port_pattern_load_step(PortData* p) {
+    u16 len = (p->arg[1] << 8) + p->arg[2];
+    while (p->cmd_pos < p->cmd_len && pattern.loaded < len) {
+        u8 levels = p->cmd_buf[p->cmd_pos++];
+        if (pattern.loaded == 0) {
+            pattern.first = levels;
+        } else {
+            port_pattern_store(pattern.loaded - 1, pattern.last, levels);
+        }
+        pattern.last = levels;
+        pattern.loaded++;
+    }
+    if (pattern.loaded < len) {
+        return EXEC_CONTINUE;
+    }
+    port_pattern_store(len - 1, pattern.last, pattern.first);
+    pattern.len = len;
+    return EXEC_DONE;
+}
+
+/// Play the loaded table on the port's pins, the first step at once and the next each period of
+/// the port's TC. DMA writes each step's toggles to the OUTTGL registers of the port's pins, so
+/// the port's SERCOM must not be in use. With FLAG_PATTERN_LOOP the table repeats until stopped;
+/// otherwise the pins hold the last step and REPLY_ASYNC_PATTERN_END is sent.
+void port_pattern_play(PortData* p) {
+    if (pattern.port != p || pattern.len == 0 || p->mode != MODE_NONE) {
+        return;
+    }
+
+    port_pattern_stop();
+    port_tc_release(p);
+
+    pattern.owner = p;
+    pattern.ended = false;
+
+    for (int i = 0; i<8; i++) {
+        if (pattern.mask & (1 << i)) {
+            Pin pin = p->port->gpio[i];
+            pin_gpio(pin);
+            pin_set(pin, pattern.first & (1 << i));
+            pin_out(pin);
+        }
+    }
+
+    bool loop = p->arg[3] & FLAG_PATTERN_LOOP;
+    u16 count = loop ? pattern.len : pattern.len - 1;
+    if (count == 0) {
+        pattern.ended = true;
+        return;
+    }
+
+    // Steps after the first are written on the TC's overflows, and on the compare matches a tick
+    // before them for pins in the other PORT group
+    PinLanes* l = &pattern.lanes;
+    port_timer_prepare_lanes(p, p->arg[0] & 0x7, (p->arg[1] << 8) + p->arg[2], 0);
+    for (u8 lane = 0; lane < l->count; lane++) {
+        DmacDescriptor* desc = &pattern_desc[lane];
+        port_lane_configure(p, lane);
+        dma_fill_register_write(desc, (volatile u8*) &PORT->Group[l->group[lane]].OUTTGL.reg + l->offset[lane],
+            l->size[lane], l->buf[lane], count);
+        desc->DESCADDR.reg = loop ? (unsigned) desc : 0;
+        dma_start_descriptor(port_lane_chan(p, lane), desc);
+    }
+    if (!loop) {
+        dma_enable_interrupt(p->dma_rx);
+    }
+    tc(p->tc_channel)->COUNT16.CTRLBSET.reg = TC_CTRLBSET_CMD_RETRIGGER;
+}
+
+/// Stop pattern playback. The pins hold the last step written.
+void port_pattern_stop() {
+    PortData* p = pattern.owner;
+    if (p == NULL) {
+        return;
+    }
+
+    port_timer_stop(p);
+    dma_abort(p->dma_rx);
+    dma_abort(p->dma_tx);
+    pattern.owner = NULL;
+    pattern.ended = false;
+}
+
+/// Called when the first lane's DMA has written the last step of one-shot playback
+void port_pattern_completion(PortData* p) {
+    pattern.ended = true;
+    if (port_async_events_allowed(p)) {
+        port_step(p);
+    }
+}
+
+/// Returns true if the port's one-shot pattern playback has ended and the reply has room
+bool port_pattern_pending(PortData* p) {
+    return pattern.owner == p && pattern.ended && p->reply_len + 1 <= BRIDGE_BUF_SIZE;
+}
+
+/// Finish one-shot pattern playback
+void port_pattern_send_end(PortData* p) {
+    port_pattern_stop();
+    port_send_status(p, REPLY_ASYNC_PATTERN_END);
+}
+
+/// Count the edges of a pin for CMD_COUNTER_START. The pin's EIC event increments the port's TC
+/// through EVSYS, so edges are counted without interrupts, and only the TC's overflows interrupt.
+/// An EIC sense of 0 stops counting.
+void port_counter_start(PortData* p) {
+    port_counter_stop(p);
+
+    u8 pin = p->arg[0] & 0x7;
+    u8 mode = (p->arg[0] >> 4) & 0x7;
+    if (mode == EIC_CONFIG_SENSE_NONE || mode > EIC_CONFIG_SENSE_BOTH
+       || !port_pin_supports_interrupt(p, pin)) {
+        return;
+    }
+
+    Pin sys_pin = p->port->gpio[pin];
+    u32 flag = 1 << pin_extint(sys_pin);
+    if (flag & (p->prog_trigger | p->uart_cts | p->pulse | p->quad)) {
+        return;
+    }
+
+    port_tc_release(p);
+
+    // The pin's edges are counted rather than reported
+    EIC->INTENCLR.reg = flag;
+    p->pin_events &= ~flag;
+
+    p->counter = flag;
+    p->counter_pin = pin;
+    p->counter_overflows = 0;
+
+    pin_mux_eic(sys_pin);
+    eic_config(sys_pin, mode);
+    evsys_config(p == &port_a ? EVSYS_COUNTER_A : EVSYS_COUNTER_B,
+        EVSYS_ID_GEN_EIC_EXTINT_0 + pin_extint(sys_pin), EVSYS_ID_USER_TC3_EVU + p->tc_channel - 3);
+    EIC->EVCTRL.reg |= flag;
+
+    port_timer_start(p, 0, 0xFFFF, TC_EVCTRL_TCEI | TC_EVCTRL_EVACT_COUNT);
+    tc(p->tc_channel)->COUNT16.INTENSET.reg = TC_INTENSET_OVF;
+}
+
+/// Stop counting edges and release the pin and the port's TC
+void port_counter_stop(PortData* p) {
+    if (!p->counter) {
+        return;
+    }
+
+    Pin sys_pin = p->port->gpio[p->counter_pin];
+    port_timer_stop(p);
+    EIC->EVCTRL.reg &= ~p->counter;
+    EVSYS->USER.reg = EVSYS_USER_CHANNEL(0) | EVSYS_USER_USER(EVSYS_ID_USER_TC3_EVU + p->tc_channel - 3);
+    eic_config(sys_pin, EIC_CONFIG_SENSE_NONE);
+    pin_gpio(sys_pin);
+    EIC->INTFLAG.reg = p->counter;
+    p->counter = 0;
+}
+
+/// Returns the edges counted since CMD_COUNTER_START, or 0 if not counting
+u32 port_counter_value(PortData* p) {
+    if (!p->counter) {
+        return 0;
+    }
+
+    tc(p->tc_channel)->COUNT16.READREQ.reg = TC_READREQ_RREQ | TC_READREQ_ADDR(TC_COUNT16_COUNT_OFFSET);
+    while (tc(p->tc_channel)->COUNT16.STATUS.bit.SYNCBUSY);
+    u16 count = tc(p->tc_channel)->COUNT16.COUNT.reg;
+
+    // The TC's interrupt can't run during a command, so an overflow may not be counted yet
+    u32 overflows = p->counter_overflows;
+    if ((tc(p->tc_channel)->COUNT16.INTFLAG.reg & TC_INTFLAG_OVF) && count < 0x8000) {
+        overflows++;
+    }
+    return (overflows << 16) | count;
+}
+
+/// Start or stop decoding a quadrature encoder for CMD_QUAD_START. Both pins interrupt on each
+/// edge, and every valid transition of their levels counts the position up or down.
+void port_quad_start(PortData* p) {
+    port_quad_stop(p);
+    if (!(p->arg[0] & FLAG_QUAD_ENABLE)) {
+        return;
+    }
+
+    u8 pin_a = p->arg[0] & 0x7;
+    u8 pin_b = (p->arg[0] >> 3) & 0x7;
+    if (pin_a == pin_b || !port_pin_supports_interrupt(p, pin_a)
+       || !port_pin_supports_interrupt(p, pin_b)) {
+        return;
+    }
+
+    Pin sys_pin_a = p->port->gpio[pin_a];
+    Pin sys_pin_b = p->port->gpio[pin_b];
+    u32 flags = (1 << pin_extint(sys_pin_a)) | (1 << pin_extint(sys_pin_b));
+    if (flags & (p->prog_trigger | p->uart_cts | p->pulse | p->counter)) {
+        return;
+    }
+
+    // The pins' edges are decoded rather than reported
+    EIC->INTENCLR.reg = flags;
+    p->pin_events &= ~flags;
+
+    p->quad = flags;
+    p->quad_pin_a = pin_a;
+    p->quad_pin_b = pin_b;
+    p->quad_position = 0;
+
+    pin_in(sys_pin_a);
+    pin_in(sys_pin_b);
+    p->quad_state = (pin_read(sys_pin_a) << 1) | pin_read(sys_pin_b);
+
+    pin_mux_eic(sys_pin_a);
+    pin_mux_eic(sys_pin_b);
+    eic_config(sys_pin_a, EIC_CONFIG_SENSE_BOTH);
+    eic_config(sys_pin_b, EIC_CONFIG_SENSE_BOTH);
+    EIC->INTFLAG.reg = flags;
+    EIC->INTENSET.reg = flags;
+}
+
+/// Stop decoding the encoder. The position is kept until the next CMD_QUAD_START.
+void port_quad_stop(PortData* p) {
+    if (!p->quad) {
+        return;
+    }
+
+    Pin sys_pin_a = p->port->gpio[p->quad_pin_a];
+    Pin sys_pin_b = p->port->gpio[p->quad_pin_b];
+    EIC->INTENCLR.reg = p->quad;
+    eic_config(sys_pin_a, EIC_CONFIG_SENSE_NONE);
+    eic_config(sys_pin_b, EIC_CONFIG_SENSE_NONE);
+    pin_gpio(sys_pin_a);
+    pin_gpio(sys_pin_b);
+    EIC->INTFLAG.reg = p->quad;
+    p->quad = 0;
+}
+
+/// Position change for each transition of the encoder's levels, indexed by the previous levels
+/// in bits 2-3 and the new levels in bits 0-1. B leading A counts up. Transitions where both
+/// levels changed skipped an edge and can't be decoded.
+const int8_t quad_steps[16] = {
+    0, 1, -1, 0,
+    -1, 0, 0, 1,
+    1, 0, 0, -1,
+    0, -1, 1, 0,
+};
+
+/// Handle an edge of either encoder pin
+void port_quad_edge(PortData* p) {
+    u8 state = (pin_read(p->port->gpio[p->quad_pin_a]) << 1) | pin_read(p->port->gpio[p->quad_pin_b]);
+    p->quad_position += quad_steps[(p->quad_state << 2) | state];
+    p->quad_state = state;
+}
+
+/// Start a CMD_LED_STRIP of arg[0..1] bytes of color data, in the order the LEDs take them
+bool port_led_strip_begin(PortData* p) {
+    u16 len = (p->arg[0] << 8) + p->arg[1];
+    if (len > LED_STRIP_SIZE) {
+        port_error(p);
+        return false;
+    }
+    return len > 0;
+}
+
+/// Expand the next color bytes of the frame into a chunk of SPI data. At 2.4 MHz, each bit of
+/// color takes three SPI bits: 100 for a 0 and 110 for a 1.
+void port_led_strip_encode(u8 chunk) {
+    LedStrip* l = &led_strip;
+    u16 size = l->len - l->encoded;
+    if (size > LED_STRIP_CHUNK) {
+        size = LED_STRIP_CHUNK;
+    }
+
+    u8* dst = l->spi[chunk];
+    for (u16 i = l->encoded; i < l->encoded + size; i++) {
+        u8 color = l->buf[i];
+        u32 bits = 0x924924;
+        for (int bit = 0; bit<8; bit++) {
+            if (color & (0x80 >> bit)) {
+                bits |= 1 << (22 - 3 * bit);
+            }
+        }
+        *dst++ = bits >> 16;
+        *dst++ = (bits >> 8) & 0xFF;
+        *dst++ = bits & 0xFF;
+    }
+    l->encoded += size;
+    l->spi_len[chunk] = size * 3;
+}
+
+/// Send the current chunk. Like CMD_TX, the transfer completes when the last byte has been
+/// received back.
+void port_led_strip_send(PortData* p) {
+    LedStrip* l = &led_strip;
+    dma_sercom_start_rx(p->dma_rx, p->port->spi, NULL, l->spi_len[l->sending]);
+    dma_sercom_start_tx(p->dma_tx, p->port->spi, l->spi[l->sending], l->spi_len[l->sending]);
+}
+
+/// Receive color data for CMD_LED_STRIP, and once the frame is complete, start sending it
+ExecStatus port_led_strip_step(PortData* p) {
+    LedStrip* l = &led_strip;
+    if (l->owner != p) {
+        l->owner = p;
+        l->len = (p->arg[0] << 8) + p->arg[1];
+        l->loaded = 0;
+    }
+
+    u32 size = p->cmd_len - p->cmd_pos;
+    if (size > (u32) (l->len - l->loaded)) {
+        size = l->len - l->loaded;
+    }
+    memcpy(&l->buf[l->loaded], &p->cmd_buf[p->cmd_pos], size);
+    l->loaded += size;
+    p->cmd_pos += size;
+    if (l->loaded < l->len) {
+        return EXEC_CONTINUE;
+    }
+
+    if (p->mode != MODE_SPI) {
+        port_led_strip_release(p);
+        return EXEC_DONE;
+    }
+
+    l->encoded = 0;
+    l->sending = 0;
+    port_led_strip_encode(0);
+    port_led_strip_send(p);
+    port_led_strip_encode(1);
+    return EXEC_ASYNC;
+}
+
+/// Called when a chunk has been sent: start the next one right away, then refill the chunk that
+/// finished
+void port_led_strip_completion(PortData* p) {
+    LedStrip* l = &led_strip;
+    l->sending ^= 1;
+    if (l->spi_len[l->sending] == 0) {
+        port_led_strip_release(p);
+        port_exec_async_complete(p, EXEC_DONE);
+        return;
+    }
+
+    port_led_strip_send(p);
+    port_led_strip_encode(l->sending ^ 1);
+}
+
+/// Free the frame buffer, resuming the other port if its frame is waiting for it
+void port_led_strip_release(PortData* p) {
+    led_strip.owner = NULL;
+
+    PortData* other = p == &port_a ? &port_b : &port_a;
+    if (other->state == PORT_EXEC && other->cmd == CMD_LED_STRIP) {
+        port_step(other);
+    }
+}
+
+/// Drive the SPI chip select pin selected by CMD_SPI_CS, if any, to its active or idle level
+void port_spi_cs(PortData* p, bool active) {
+    if (!(p->spi_cs & FLAG_SPI_CS_ENABLE)) {
+        return;
+    }
+    Pin pin = p->port->gpio[p->spi_cs & 0x7];
+    if (active == !!(p->spi_cs & FLAG_SPI_CS_ACTIVE_HIGH)) {
+        pin_high(pin);
+    } else {
+        pin_low(pin);
+    }
+    pin_out(pin);
+}
+
+/// Returns the bytes of a long-form transfer left after the chunk of at most 255 bytes counted
+/// in arg[0]. CMD_TX_LONG, CMD_RX_LONG and CMD_TXRX_LONG execute as their one-byte forms, with
+/// the rest of the length in arg[1..2].
+u16 port_long_remaining(PortData* p) {
+    switch (p->cmd) {
+        case CMD_TX:
+        case CMD_RX:
+        case CMD_TXRX:
+            return (p->arg[1] << 8) + p->arg[2];
+        default:
+            return 0;
+    }
+}
+
+/// Move the next chunk of a long-form transfer into arg[0]
+void port_long_next(PortData* p) {
+    u16 remaining = port_long_remaining(p);
+    u8 size = remaining < 255 ? remaining : 255;
+    remaining -= size;
+    p->arg[0] = size;
+    p->arg[1] = remaining >> 8;
+    p->arg[2] = remaining & 0xff;
+}
+
+/// Begin a TX, RX or TXRX, either form, for the length set up in the arguments
+ExecStatus port_begin_transfer(PortData* p) {
+    if (p->cmd != CMD_TX) {
+        port_send_status(p, REPLY_DATA);
+    }
+    if (p->mode == MODE_SPI) {
+        port_spi_cs(p, true);
+    }
+    return EXEC_CONTINUE;
+}
+
+/// Returns true if the CMD_START being executed is directly followed in cmd_buf by a whole TX or
+/// RX in the same direction and a CMD_STOP, so that the transfer can be made by DMA
+bool port_i2c_dma_possible(PortData* p) {
+    u16 pos = p->cmd_pos;
+    if (pos + 2 > p->cmd_len) {
+        return false;
+    }
+
+    u8 cmd = p->cmd_buf[pos];
+    u8 len = p->cmd_buf[pos + 1];
+    bool read = p->arg[0] & 1;
+    if (len == 0) {
+        return false;
+    } else if (cmd == CMD_TX && !read) {
+        pos += 2 + len;
+    } else if (cmd == CMD_RX && read && p->reply_len + 1 + len <= BRIDGE_BUF_SIZE) {
+        pos += 2;
+    } else {
+        return false;
+    }
+    return pos < p->cmd_len && p->cmd_buf[pos] == CMD_STOP;
+}
+
+/// Address the I2C device saved by CMD_START for a transfer of len bytes by the port's DMA
+/// channels. The SERCOM's length counter ends the transfer: it NACKs the last byte of a read
+/// and sends STOP, so the bytes need no interrupts.
+void port_i2c_dma_start(PortData* p, u8 len) {
+    sercom(p->port->uart_i2c)->I2CM.CTRLB.reg = SERCOM_I2CM_CTRLB_SMEN;
+    while(sercom(p->port->uart_i2c)->I2CM.SYNCBUSY.bit.SYSOP) {}
+    sercom(p->port->uart_i2c)->I2CM.ADDR.reg
+        = p->i2c_addr
+        | SERCOM_I2CM_ADDR_LENEN
+        | SERCOM_I2CM_ADDR_LEN(len);
+    if (p->i2c_addr & 1) {
+        // Reads only set MB if the address is NACKed
+        sercom(p->port->uart_i2c)->I2CM.INTENSET.reg = SERCOM_I2CM_INTENSET_MB;
+    }
+}
+
+/// Leave smart mode once a DMA transfer has finished
+void port_i2c_dma_finish(PortData* p) {
+    p->i2c_dma = false;
+    sercom(p->port->uart_i2c)->I2CM.INTENCLR.reg = SERCOM_I2CM_INTENCLR_MB;
+    while(sercom(p->port->uart_i2c)->I2CM.SYNCBUSY.bit.SYSOP) {}
+    sercom(p->port->uart_i2c)->I2CM.CTRLB.reg = 0;
+    while(sercom(p->port->uart_i2c)->I2CM.SYNCBUSY.bit.SYSOP) {}
+}
+
+/// Returns true if an I2C command is waiting in PORT_EXEC for room in reply_buf for its whole
+/// reply, which it fills while the buffer is held in PORT_EXEC_ASYNC. Its phase, counted in
+/// arg[3], is 0 until it starts.
+bool port_i2c_blocked(PortData* p) {
+    if (p->state != PORT_EXEC || p->arg[3] != 0) {
+        return false;
+    }
+    switch (p->cmd) {
+        case CMD_I2C_READ_REG:
+            return p->reply_len + 1 + p->arg[0] > BRIDGE_BUF_SIZE;
+        case CMD_I2C_SCAN:
+            return p->reply_len + 1 + I2C_SCAN_SIZE > BRIDGE_BUF_SIZE;
+        default:
+            return false;
+    }
+}
+
+/// Read the outcome of the last I2C bus operation, clearing the SERCOM's error flags
+u8 port_i2c_result(PortData* p) {
+    bool error = sercom(p->port->uart_i2c)->I2CM.INTFLAG.bit.ERROR;
+    u16 status = sercom(p->port->uart_i2c)->I2CM.STATUS.reg;
+    sercom(p->port->uart_i2c)->I2CM.INTFLAG.reg = SERCOM_I2CM_INTFLAG_ERROR;
+    sercom(p->port->uart_i2c)->I2CM.STATUS.reg
+        = SERCOM_I2CM_STATUS_BUSERR
+        | SERCOM_I2CM_STATUS_ARBLOST
+        | SERCOM_I2CM_STATUS_LENERR;
+
+    if (status & SERCOM_I2CM_STATUS_ARBLOST) {
+        return REPLY_I2C_ARB_LOST;
+    } else if (status & (SERCOM_I2CM_STATUS_RXNACK | SERCOM_I2CM_STATUS_LENERR)) {
+        return REPLY_NACK;
+    } else if (error) {
+        return REPLY_I2C_BUS_ERROR;
+    }
+    return REPLY_ACK;
+}
+
+/// Send STOP if the port still owns the bus
+void port_i2c_stop(PortData* p) {
+    if (sercom(p->port->uart_i2c)->I2CM.STATUS.bit.BUSSTATE == 2) {
+        sercom(p->port->uart_i2c)->I2CM.CTRLB.bit.ACKACT = 1;
+        while(sercom(p->port->uart_i2c)->I2CM.SYNCBUSY.bit.SYSOP) {}
+        sercom(p->port->uart_i2c)->I2CM.CTRLB.bit.CMD = 3;
+    }
+}
+
+/// End a failed I2C transaction, keeping the reason to report with CMD_I2C_STATUS. The port
+/// stays usable: the transaction's remaining TX payloads are discarded and RX replies are
+/// zero-filled up to its CMD_STOP.
+void port_i2c_fail(PortData* p, u8 status) {
+    p->i2c_status = status;
+    p->i2c_failed = true;
+    sercom(p->port->uart_i2c)->I2CM.INTENCLR.reg = SERCOM_I2CM_INTENCLR_SB | SERCOM_I2CM_INTENCLR_MB;
+    if (p->i2c_dma) {
+        dma_abort(p->dma_tx);
+        dma_abort(p->dma_rx);
+        port_i2c_dma_finish(p);
+    }
+    port_i2c_stop(p);
+
+    // A register read is its own transaction, and replies with the status in place of the data
+    if (p->cmd == CMD_I2C_READ_REG) {
+        if (p->arg[3] > 2) {
+            p->reply_len -= 1 + p->arg[0];
+        }
+        port_send_status(p, status);
+        p->arg[0] = 0;
+        p->i2c_failed = false;
+    }
+}
+
+/// Address the next device of a CMD_I2C_SCAN, arg[0] addresses before the end
+void port_i2c_scan_probe(PortData* p) {
+    while(sercom(p->port->uart_i2c)->I2CM.SYNCBUSY.bit.SYSOP) {}
+    sercom(p->port->uart_i2c)->I2CM.ADDR.reg = (I2C_SCAN_LAST + 1 - p->arg[0]) << 1;
+    sercom(p->port->uart_i2c)->I2CM.INTENSET.reg = SERCOM_I2CM_INTENSET_MB;
+}
+
+/// Record the result of a CMD_I2C_SCAN probe in the bitmap at the end of reply_buf and probe the
+/// next address. The scan stays in PORT_EXEC_ASYNC throughout, so reply_buf is not sent meanwhile.
+void port_i2c_scan_result(PortData* p, u8 result) {
+    u8 addr = I2C_SCAN_LAST + 1 - p->arg[0];
+    if (result == REPLY_ACK) {
+        p->reply_buf[p->reply_len - I2C_SCAN_SIZE + addr / 8] |= 1 << (addr % 8);
+    }
+    port_i2c_stop(p);
+
+    if (--p->arg[0] == 0) {
+        p->state = EXEC_DONE;
+        port_step(p);
+    } else {
+        port_i2c_scan_probe(p);
+    }
+}
+
+/// Advance a CMD_I2C_READ_REG to its next phase, counted in arg[3]. Each phase ends with an
+/// interrupt: addressing the device for writing, sending the register number, then a repeated
+/// start and a DMA read of arg[0] bytes that the SERCOM ends with NACK and STOP.
+ExecStatus port_i2c_read_reg_step(PortData* p) {
+    switch (p->arg[3]++) {
+        case 0:
+            while(sercom(p->port->uart_i2c)->I2CM.SYNCBUSY.bit.SYSOP) {}
+            sercom(p->port->uart_i2c)->I2CM.ADDR.reg = p->arg[1] & ~1;
+            sercom(p->port->uart_i2c)->I2CM.INTENSET.reg = SERCOM_I2CM_INTENSET_MB;
+            return EXEC_ASYNC;
+        case 1:
+            while(sercom(p->port->uart_i2c)->I2CM.SYNCBUSY.bit.SYSOP) {}
+            sercom(p->port->uart_i2c)->I2CM.DATA.reg = p->arg[2];
+            sercom(p->port->uart_i2c)->I2CM.INTENSET.reg = SERCOM_I2CM_INTENSET_MB;
+            return EXEC_ASYNC;
+        case 2:
+            port_send_status(p, REPLY_DATA);
+            dma_sercom_start_rx(p->dma_rx, p->port->uart_i2c, &p->reply_buf[p->reply_len], p->arg[0]);
+            p->reply_len += p->arg[0];
+            p->i2c_addr = p->arg[1] | 1;
+            p->i2c_dma = true;
+            port_i2c_dma_start(p, p->arg[0]);
+            return EXEC_ASYNC;
+        default:
+            // As for CMD_STOP, in case the SERCOM hasn't already sent it
+            port_i2c_dma_finish(p);
+            sercom(p->port->uart_i2c)->I2CM.CTRLB.bit.ACKACT = 1;
+            sercom(p->port->uart_i2c)->I2CM.CTRLB.bit.CMD = 3;
+            p->arg[0] = 0;
+            return EXEC_DONE;
+    }
+}
+
+/// Returns true if a due program iteration can't start until reply_buf is queued
+bool port_prog_blocked(PortData* p) {
+    return p->prog_due && !p->prog_active
+        && p->reply_len + PORT_PROG_FRAME_HEADER + p->prog_reply_size + PORT_REPLY_RESERVE > BRIDGE_BUF_SIZE;
+}
+
+/// Switch the parser from the command ring to the program for one iteration. Its replies are
+/// collected in a REPLY_ASYNC_PROG_DATA frame whose header is filled in by port_prog_end.
+void port_prog_begin(PortData* p) {
+    p->prog_due = false;
+    p->prog_active = true;
+    p->prog_resume_pos = p->cmd_pos;
+    p->cmd_buf = p->prog_buf;
+    p->cmd_len = p->prog_len;
+    p->cmd_pos = 0;
+    p->prog_frame = p->reply_len;
+    p->reply_len += PORT_PROG_FRAME_HEADER;
+}
+
+/// Finish a program iteration and return the parser to the command ring
+void port_prog_end(PortData* p) {
+    u16 len = p->reply_len - p->prog_frame - PORT_PROG_FRAME_HEADER;
+    p->reply_buf[p->prog_frame] = REPLY_ASYNC_PROG_DATA;
+    p->reply_buf[p->prog_frame + 1] = len >> 8;
+    p->reply_buf[p->prog_frame + 2] = len & 0xFF;
+
+    p->prog_active = false;
+    p->cmd_buf = p->cmd_ring[p->cmd_head];
+    p->cmd_len = p->cmd_count > 0 ? p->cmd_lens[p->cmd_head] : 0;
+    p->cmd_pos = p->prog_resume_pos;
+
+    if (!p->prog_forever && --p->prog_remaining == 0) {
+        port_prog_stop(p);
+        port_send_status(p, REPLY_ASYNC_PROG_END);
+    } else if (++p->prog_batched >= p->prog_batch) {
+        p->prog_batched = 0;
+        p->prog_held = 0;
+    } else {
+        p->prog_held += PORT_PROG_FRAME_HEADER + len;
+    }
+}
+
+/// Returns the number of bytes received by the UART's DMA ring, wrapping around. The write-back
+/// descriptor may still hold the half that just completed, whose end is the start of the next.
+u32 port_uart_received(PortData* p) {
+    u8* start = &p->uart_buf.rx[p->uart_buf.filling * (UART_RX_SIZE / 2)];
+    u32 offset = (dma_next_dst(p->dma_rx) - start + UART_RX_SIZE) % UART_RX_SIZE;
+    return p->uart_buf.base + offset;
+}
+
+/// Drop the bytes that DMA has overwritten or is about to overwrite before they were sent
+void port_uart_catch_up(PortData* p, u32 received) {
+    u32 pending = received - p->uart_buf.sent;
+    if (pending > UART_RX_SIZE - UART_RX_MARGIN) {
+        u32 dropped = pending - (UART_RX_SIZE - UART_RX_MARGIN);
+        p->uart_buf.sent += dropped;
+        if (dropped > 0xFFFFu - p->uart_buf.dropped) {
+            dropped = 0xFFFFu - p->uart_buf.dropped;
+        }
+        p->uart_buf.dropped += dropped;
+    }
+}
+
+/// Drive RTS high to stop the sender while the receive ring is half full, or a quarter full while
+/// the last reply buffer is still waiting for the bridge
+void port_uart_rts(PortData* p) {
+    if (!p->uart_rts) {
+        return;
+    }
+    u32 pending = port_uart_received(p) - p->uart_buf.sent;
+    bool stop = pending >= UART_RX_SIZE / 2 || (pending >= UART_RX_SIZE / 4 && p->pending_in);
+    pin_set(p->port->gpio[p->uart_rts_pin], stop);
+}
+
+/// Flush pending received UART data to the reply buffer, as many REPLY_ASYNC_UART_RX frames of up
+/// to 255 bytes as fit
+void uart_send_data(PortData *p){
+    u32 received = port_uart_received(p);
+    port_uart_catch_up(p, received);
+    p->uart_buf.polled = received;
+
+    u32 pending = received - p->uart_buf.sent;
+    if (pending == 0) {
+        return;
+    }
+
+    while (pending > 0 && p->reply_len + 3 <= BRIDGE_BUF_SIZE) {
+        // pad 2 bytes at the beginning
+        // 1st byte indicates uart rx
+        // 2nd byte indicates uart rx number.
+        // this also means rx number has to be <=255
+        u32 count = pending;
+        if (count > 255) {
+            count = 255;
+        }
+        if (count > BRIDGE_BUF_SIZE - p->reply_len - 2) {
+            count = BRIDGE_BUF_SIZE - p->reply_len - 2;
+        }
+
+        p->reply_buf[p->reply_len++] = REPLY_ASYNC_UART_RX;
+        p->reply_buf[p->reply_len++] = count;
+
+        // copy data into reply buf, in two parts if it wraps around the ring
+        u32 tail = p->uart_buf.sent % UART_RX_SIZE;
+        u32 first = count < UART_RX_SIZE - tail ? count : UART_RX_SIZE - tail;
+        memcpy(&p->reply_buf[p->reply_len], &p->uart_buf.rx[tail], first);
+        memcpy(&p->reply_buf[p->reply_len + first], &p->uart_buf.rx[0], count - first);
+        p->reply_len += count;
+
+        p->uart_buf.sent += count;
+        pending -= count;
+    }
+    port_uart_rts(p);
+    port_step(p);
+}
+
+/// Check the UART's received data on each expiry of the port's TCC, sending it once the line is
+/// idle or enough has built up
+void port_uart_poll(PortData *p) {
+    tcc_delay_start(p->tcc_channel, UART_RX_POLL_TICKS);
+
+    u32 received = port_uart_received(p);
+    if (received == p->uart_buf.polled && received != p->uart_buf.sent) {
+        uart_send_data(p);
+    } else if (received - p->uart_buf.sent >= UART_RX_SIZE / 4) {
+        uart_send_data(p);
+    } else {
+        p->uart_buf.polled = received;
+        port_uart_rts(p);
+    }
+}
+
+/// Pause the UART's transmit DMA while CTS is high
+void port_uart_cts(PortData* p) {
+    if (!p->uart_cts) {
+        return;
+    }
+    if (pin_read(p->port->gpio[p->uart_cts_pin])) {
+        dma_suspend(p->dma_tx);
+    } else {
+        dma_resume(p->dma_tx);
+    }
+}
+
+/// Turn off flow control, releasing the CTS pin's interrupt and any paused transmission
+void port_uart_flow_stop(PortData* p) {
+    if (p->uart_cts) {
+        EIC->INTENCLR.reg = p->uart_cts;
+        eic_config(p->port->gpio[p->uart_cts_pin], EIC_CONFIG_SENSE_NONE);
+        pin_gpio(p->port->gpio[p->uart_cts_pin]);
+        EIC->INTFLAG.reg = p->uart_cts;
+        p->uart_cts = 0;
+        dma_resume(p->dma_tx);
+    }
+    p->uart_rts = false;
+}
+
+/// Set up flow control from the CMD_UART_FLOW argument. The SERCOM's own RTS and CTS pads are
+/// the ones used for TX and RX, so spare port pins are driven and read instead. CTS must be a pin
+/// that supports interrupts; it is reserved like a program trigger and sends no pin change events.
+void port_uart_flow(PortData* p) {
+    port_uart_flow_stop(p);
+
+    if (p->arg[0] & FLAG_UART_RTS) {
+        p->uart_rts = true;
+        p->uart_rts_pin = p->arg[0] & 0x7;
+        port_uart_rts(p);
+        pin_out(p->port->gpio[p->uart_rts_pin]);
+    }
+
+    u8 cts_pin = (p->arg[0] >> 3) & 0x7;
+    if ((p->arg[0] & FLAG_UART_CTS) && port_pin_supports_interrupt(p, cts_pin)) {
+        Pin sys_pin = p->port->gpio[cts_pin];
+        p->uart_cts_pin = cts_pin;
+        p->uart_cts = 1 << pin_extint(sys_pin);
+        pin_in(sys_pin);
+        pin_mux_eic(sys_pin);
+        eic_config(sys_pin, EIC_CONFIG_SENSE_BOTH);
+        EIC->INTFLAG.reg = p->uart_cts;
+        EIC->INTENSET.reg = p->uart_cts;
+        port_uart_cts(p);
+    }
+}
+
+/// DMA has filled a half of the UART's ring and moved on to the other
+void port_uart_half_completion(PortData* p) {
+    p->uart_buf.base += UART_RX_SIZE / 2;
+    p->uart_buf.filling ^= 1;
+
+    if (port_async_events_allowed(p)) {
+        uart_send_data(p);
+    } else {
+        port_uart_catch_up(p, port_uart_received(p));
+        port_uart_rts(p);
+    }
+}
+
+/// Begin execution of a command. This function performs the setup for commands with payloads,
+/// or the entire execution for commands that do not have payloads.
+///   EXEC_DONE: move on to the next command
+///   EXEC_CONTINUE: schedule port_continue_command to be called with a part of the payload when
+///                  available
+ExecStatus port_begin_cmd(PortData *p) {
+    switch (p->cmd) {
+        case CMD_NOP:
+            return EXEC_DONE;
+
+        case CMD_ECHO:
+            port_send_status(p, REPLY_DATA);
+            return EXEC_CONTINUE;
+
+        case CMD_TX:
+        case CMD_RX:
+        case CMD_TXRX:
+            p->arg[1] = 0;
+            p->arg[2] = 0;
+            return port_begin_transfer(p);
+
+        case CMD_TX_LONG:
+        case CMD_RX_LONG:
+        case CMD_TXRX_LONG:
+            p->cmd = p->cmd == CMD_TX_LONG ? CMD_TX : p->cmd == CMD_RX_LONG ? CMD_RX : CMD_TXRX;
+            p->arg[2] = p->arg[1];
+            p->arg[1] = p->arg[0];
+            port_long_next(p);
+            return port_begin_transfer(p);
+
+        case CMD_SPI_CS:
+            // Release the previous pin before switching
+            p->spi_cs_hold = false;
+            port_spi_cs(p, false);
+            p->spi_cs = p->arg[0] & ~FLAG_SPI_CS_HOLD;
+            port_spi_cs(p, false);
+            if (p->arg[0] & FLAG_SPI_CS_HOLD) {
+                p->spi_cs_hold = true;
+                port_spi_cs(p, true);
+            }
+            return EXEC_DONE;
+
+        case CMD_PROG_LOAD:
+            port_prog_stop(p);
+            p->prog_len = 0;
+            return p->arg[0] == 0 ? EXEC_DONE : EXEC_CONTINUE;
+
+        case CMD_PROG_RUN:
+            port_prog_run(p);
+            return EXEC_DONE;
+
+        case CMD_PROG_STOP:
+            port_prog_stop(p);
+            return EXEC_DONE;
+
+        case CMD_PROG_TRIGGER:
+            port_prog_trigger(p);
+            return EXEC_DONE;
+
+        case CMD_ADC_STREAM_START:
+            port_adc_stream_start(p);
+            return EXEC_DONE;
+
+        case CMD_ADC_STREAM_STOP:
+            if (adc_stream.owner == p) {
+                port_adc_stream_stop();
+            }
+            return EXEC_DONE;
+
+        case CMD_DAC_WAVE_LOAD:
+            return port_dac_wave_load(p) ? EXEC_CONTINUE : EXEC_DONE;
+
+        case CMD_DAC_WAVE_PLAY:
+            port_dac_wave_play(p);
+            return EXEC_DONE;
 
-        if (count + 2 > BRIDGE_BUF_SIZE - p->reply_len) {
-            // Shouldn't have to worry about insufficient buffer space because the buffer is
-            // always flushed before enabling async events, but assert to be sure.
-            port_error(p);
-            return;
-        }
+        case CMD_DAC_WAVE_STOP:
+            if (dac_wave.owner == p) {
+                port_dac_wave_stop();
+            }
+            return EXEC_DONE;
 
-        p->reply_buf[p->reply_len++] = REPLY_ASYNC_UART_RX;
-        p->reply_buf[p->reply_len++] = count;
+        case CMD_PATTERN_LOAD:
+            return port_pattern_load(p) ? EXEC_CONTINUE : EXEC_DONE;
 
-        // copy data into reply buf
-        for (uint8_t i = 0; i < count; i++) {
-            p->reply_buf[p->reply_len++] = p->uart_buf.rx[p->uart_buf.tail];
-            p->uart_buf.tail = (p->uart_buf.tail + 1) % UART_RX_SIZE;
-        }
+        case CMD_PATTERN_PLAY:
+            port_pattern_play(p);
+            return EXEC_DONE;
 
-        p->uart_buf.buf_len -= count;
-        port_step(p);
-    }
-}
+        case CMD_PATTERN_STOP:
+            if (pattern.owner == p) {
+                port_pattern_stop();
+            }
+            return EXEC_DONE;
 
-/// Begin execution of a command. This function performs the setup for commands with payloads,
-/// or the entire execution for commands that do not have payloads.
-///   EXEC_DONE: move on to the next command
-///   EXEC_CONTINUE: schedule port_continue_command to be called with a part of the payload when
-///                  available
-ExecStatus port_begin_cmd(PortData *p) {
-    switch (p->cmd) {
-        case CMD_NOP:
+        case CMD_COUNTER_START:
+            port_counter_start(p);
             return EXEC_DONE;
 
-        case CMD_ECHO:
-        case CMD_RX:
-        case CMD_TXRX:
+        case CMD_COUNTER_READ: {
+            u32 count = port_counter_value(p);
             port_send_status(p, REPLY_DATA);
-            return EXEC_CONTINUE;
+            port_send_u32(p, count);
+            port_send_u32(p, timestamp_us());
+            return EXEC_DONE;
+        }
 
-        case CMD_TX:
-            return EXEC_CONTINUE;
+        case CMD_QUAD_START:
+            port_quad_start(p);
+            return EXEC_DONE;
+
+        case CMD_QUAD_READ:
+            port_send_status(p, REPLY_DATA);
+            port_send_u32(p, p->quad_position);
+            return EXEC_DONE;
+
+        case CMD_LED_STRIP:
+            return port_led_strip_begin(p) ? EXEC_CONTINUE : EXEC_DONE;
 
         case CMD_GPIO_IN:
             pin_in(port_selected_pin(p));
@@ -353,6 +2401,27 @@ ExecStatus port_begin_cmd(PortData *p) {
             pin_out(port_selected_pin(p));
             return EXEC_DONE;
 
+        case CMD_GPIO_READ_ALL:
+            port_send_status(p, REPLY_DATA);
+            port_send_status(p, port_gpio_read_all(p));
+            return EXEC_DONE;
+
+        case CMD_GPIO_WRITE_MASK:
+            port_gpio_write_mask(p, p->arg[0], p->arg[1]);
+            return EXEC_DONE;
+
+        case CMD_GPIO_DIR_MASK:
+            for (int i = 0; i<8; i++) {
+                if (p->arg[0] & (1 << i)) {
+                    if (p->arg[1] & (1 << i)) {
+                        pin_out(p->port->gpio[i]);
+                    } else {
+                        pin_in(p->port->gpio[i]);
+                    }
+                }
+            }
+            return EXEC_DONE;
+
         case CMD_GPIO_PULL: {
             // Extract the pin number
             u8 pin = p->arg[0] & 0x7;
@@ -413,6 +2482,9 @@ ExecStatus port_begin_cmd(PortData *p) {
             return EXEC_DONE;
 
         case CMD_ANALOG_READ: {
+            // A single conversion needs the ADC back from streaming
+            port_adc_stream_stop();
+
             // copy analog data into reply buffer
             u16 val = adc_read(port_selected_pin(p), ADC_INPUTCTRL_GAIN_DIV2);
 
@@ -424,11 +2496,16 @@ ExecStatus port_begin_cmd(PortData *p) {
         }
 
         case CMD_ANALOG_WRITE:
+            port_dac_wave_stop();
             // get the higher and lower args
             dac_write(PORT_B.g3, (p->arg[0] << 8) + p->arg[1]);
             return EXEC_DONE;
 
         case CMD_ENABLE_SPI:
+            // The SERCOM takes over the DMA channels of pattern playback
+            if (pattern.owner == p) {
+                port_pattern_stop();
+            }
             // set up clock in case we need to use a divider
             sercom_clock_enable(p->port->spi, p->clock_channel, p->arg[2]);
             // can only do spi master
@@ -448,14 +2525,27 @@ ExecStatus port_begin_cmd(PortData *p) {
             pin_gpio(p->port->mosi);
             pin_gpio(p->port->miso);
             pin_gpio(p->port->sck);
+            p->spi_cs_hold = false;
+            port_spi_cs(p, false);
+            p->spi_cs = 0;
             p->mode = MODE_NONE;
             return EXEC_DONE;
 
         case CMD_ENABLE_I2C:
+            if (pattern.owner == p) {
+                port_pattern_stop();
+            }
             sercom_i2c_master_init(p->port->uart_i2c, p->arg[0]);
             pin_mux(p->port->sda);
             pin_mux(p->port->scl);
             sercom(p->port->uart_i2c)->I2CM.INTENSET.reg = SERCOM_I2CM_INTENSET_ERROR;
+            dma_sercom_configure_tx(p->dma_tx, p->port->uart_i2c);
+            dma_sercom_configure_rx(p->dma_rx, p->port->uart_i2c);
+            dma_enable_interrupt(p->dma_tx);
+            dma_enable_interrupt(p->dma_rx);
+            p->i2c_dma = false;
+            p->i2c_status = REPLY_ACK;
+            p->i2c_failed = false;
             p->mode = MODE_I2C;
             return EXEC_DONE;
 
@@ -466,6 +2556,18 @@ ExecStatus port_begin_cmd(PortData *p) {
             return EXEC_DONE;
 
         case CMD_START:
+            // A failed transaction skips its repeated starts
+            if (p->i2c_failed) {
+                return EXEC_DONE;
+            }
+            p->i2c_status = REPLY_ACK;
+
+            // A whole transfer is addressed by the TX or RX, when its length is known
+            if (port_i2c_dma_possible(p)) {
+                p->i2c_addr = p->arg[0];
+                p->i2c_dma = true;
+                return EXEC_DONE;
+            }
             while(sercom(p->port->uart_i2c)->I2CM.SYNCBUSY.bit.SYSOP) {}
             sercom(p->port->uart_i2c)->I2CM.ADDR.reg = p->arg[0];
             if (p->arg[0] & 1)  {
@@ -477,11 +2579,37 @@ ExecStatus port_begin_cmd(PortData *p) {
             return EXEC_ASYNC;
 
         case CMD_STOP:
+            // A failed transaction was stopped when it failed
+            if (p->i2c_failed) {
+                p->i2c_failed = false;
+                return EXEC_DONE;
+            }
+            if (p->i2c_dma) {
+                // The SERCOM has already sent STOP, in which case this one is ignored
+                port_i2c_dma_finish(p);
+            }
             sercom(p->port->uart_i2c)->I2CM.CTRLB.bit.ACKACT = 1;
             sercom(p->port->uart_i2c)->I2CM.CTRLB.bit.CMD = 3;
             return EXEC_DONE;
 
+        case CMD_I2C_READ_REG:
+            // Wait in PORT_EXEC for room for the reply before addressing the device
+            p->i2c_status = REPLY_ACK;
+            p->arg[3] = 0;
+            return p->arg[0] == 0 ? EXEC_DONE : EXEC_CONTINUE;
+
+        case CMD_I2C_STATUS:
+            port_send_status(p, p->i2c_status);
+            return EXEC_DONE;
+
+        case CMD_I2C_SCAN:
+            p->arg[3] = 0;
+            return EXEC_CONTINUE;
+
         case CMD_ENABLE_UART:
+            if (pattern.owner == p) {
+                port_pattern_stop();
+            }
             // set up uart
             pin_mux(p->port->tx);
             pin_mux(p->port->rx);
@@ -492,20 +2620,75 @@ ExecStatus port_begin_cmd(PortData *p) {
 
             p->mode = MODE_UART;
 
-            p->uart_buf.head = 0;
-            p->uart_buf.tail = 0;
-            p->uart_buf.buf_len = 0;
-            // set up interrupt on uart receive data complete
-            sercom(p->port->uart_i2c)->USART.INTENSET.reg = SERCOM_USART_INTFLAG_RXC;
+            // Receive continuously into the halves of a ring, interrupting as each is filled
+            p->uart_buf.filling = 0;
+            p->uart_buf.base = 0;
+            p->uart_buf.sent = 0;
+            p->uart_buf.polled = 0;
+            p->uart_buf.dropped = 0;
+            p->uart_buf.overflows = 0;
+            for (int i = 0; i<2; i++) {
+                dma_fill_sercom_rx(&p->uart_buf.desc[i], p->port->uart_i2c,
+                    &p->uart_buf.rx[i * (UART_RX_SIZE / 2)], UART_RX_SIZE / 2);
+                p->uart_buf.desc[i].BTCTRL.reg |= DMAC_BTCTRL_BLOCKACT_INT;
+            }
+            p->uart_buf.desc[0].DESCADDR.reg = (unsigned) &p->uart_buf.desc[1];
+            p->uart_buf.desc[1].DESCADDR.reg = (unsigned) &p->uart_buf.desc[0];
+            dma_sercom_configure_rx(p->dma_rx, p->port->uart_i2c);
+            dma_enable_interrupt(p->dma_rx);
+            dma_start_descriptor(p->dma_rx, p->uart_buf.desc);
+
+            // Count bytes lost by the SERCOM
+            sercom(p->port->uart_i2c)->USART.INTENSET.reg = SERCOM_USART_INTENSET_ERROR;
 
-            // set up interrupt timer so that uart data will get written on timeout
+            // set up interrupt timer so that uart data will get written when the line is idle
             tcc_delay_enable(p->tcc_channel);
+            tcc_delay_start(p->tcc_channel, UART_RX_POLL_TICKS);
+
+            return EXEC_DONE;
+
+        case CMD_UART_FLOW:
+            port_uart_flow(p);
+            return EXEC_DONE;
+
+        case CMD_GPIO_EVENTS:
+            port_pin_events(p);
+            return EXEC_DONE;
+
+        case CMD_GPIO_PULSE:
+            if (!port_pulse_begin(p)) {
+                port_send_status(p, REPLY_TIMEOUT);
+                return EXEC_DONE;
+            }
+            return EXEC_ASYNC;
+
+        case CMD_CAPTURE_TRIGGER:
+            p->capture_trigger = p->arg[0];
+            p->capture_timeout = (p->arg[1] << 8) + p->arg[2];
+            return EXEC_DONE;
+
+        case CMD_CAPTURE:
+            if (!port_capture_begin(p)) {
+                port_send_status(p, REPLY_BUSY);
+                return EXEC_DONE;
+            }
+            return EXEC_ASYNC;
 
+        case CMD_UART_STATUS:
+            port_send_status(p, REPLY_DATA);
+            port_send_status(p, p->uart_buf.dropped >> 8);
+            port_send_status(p, p->uart_buf.dropped & 0xFF);
+            port_send_status(p, p->uart_buf.overflows >> 8);
+            port_send_status(p, p->uart_buf.overflows & 0xFF);
+            p->uart_buf.dropped = 0;
+            p->uart_buf.overflows = 0;
             return EXEC_DONE;
 
         case CMD_DISABLE_UART:
+            port_uart_flow_stop(p);
             p->mode = MODE_NONE;
-            sercom(p->port->uart_i2c)->USART.INTENCLR.reg = SERCOM_USART_INTFLAG_RXC;
+            sercom(p->port->uart_i2c)->USART.INTENCLR.reg = SERCOM_USART_INTENCLR_ERROR;
+            dma_abort(p->dma_rx);
             tcc_delay_disable(p->tcc_channel);
             pin_gpio(p->port->tx);
             pin_gpio(p->port->rx);
@@ -520,6 +2703,11 @@ ExecStatus port_begin_cmd(PortData *p) {
             pwm_set_pin_duty(p->port->gpio[pin], duty_cycle);
             return EXEC_DONE;
         }
+        case CMD_TAG:
+            p->tag = p->arg[0];
+            p->tag_pending = true;
+            return EXEC_DONE;
+
         case CMD_PWM_PERIOD: {
             // The TCC to use is first 4 bits
             u8 tcc_id = (p->arg[0] & 0x7);
@@ -527,6 +2715,10 @@ ExecStatus port_begin_cmd(PortData *p) {
             u8 prescalar = (p->arg[0] >> 4);
             // The TCC period is next 2 bytes
             u16 period = (p->arg[1] << 8) + p->arg[2];
+            if (tcc_id >= PWM_NUM_BANKS) {
+                port_error(p);
+                return EXEC_DONE;
+            }
             // Set the period on the bank
             pwm_bank_set_period(tcc_id, prescalar, period);
             return EXEC_DONE;
@@ -536,6 +2728,25 @@ ExecStatus port_begin_cmd(PortData *p) {
     return EXEC_DONE;
 }
 
+/// Begin a command, prefixing its reply with the tag if it follows CMD_TAG
+ExecStatus port_start_cmd(PortData *p) {
+    if (p->tag_pending && p->cmd != CMD_TAG) {
+        p->tag_pending = false;
+        p->cmd_tagged = true;
+        port_send_status(p, REPLY_TAGGED);
+        port_send_status(p, p->tag);
+    }
+    return port_begin_cmd(p);
+}
+
+/// Complete a tagged command once it is done
+void port_finish_tagged_cmd(PortData *p) {
+    if (!port_cmd_has_reply(p->cmd)) {
+        port_send_status(p, REPLY_ACK);
+    }
+    p->cmd_tagged = false;
+}
+
 /// Called to process the payload of a command. It is not guaranteed that the full payload will
 /// be available in one chunk, so this function is called on events until it returns EXEC_DONE.
 ExecStatus port_continue_cmd(PortData *p) {
@@ -549,12 +2760,25 @@ ExecStatus port_continue_cmd(PortData *p) {
             return p->arg[0] == 0 ? EXEC_DONE : EXEC_CONTINUE;
         }
         case CMD_TX:
+            if (p->mode == MODE_I2C && p->i2c_failed) {
+                // Discard the data of a failed transaction
+                u32 size = port_tx_len(p);
+                p->cmd_pos += size;
+                p->arg[0] -= size;
+                return p->arg[0] == 0 ? EXEC_DONE : EXEC_CONTINUE;
+            }
             if (p->mode == MODE_SPI) {
                 u32 size = port_tx_len(p);
                 dma_sercom_start_rx(p->dma_rx, p->port->spi, NULL, size);
                 dma_sercom_start_tx(p->dma_tx, p->port->spi, &p->cmd_buf[p->cmd_pos], size);
                 p->cmd_pos += size;
                 p->arg[0] -= size;
+            } else if (p->mode == MODE_I2C && p->i2c_dma) {
+                u32 size = p->arg[0];
+                dma_sercom_start_tx(p->dma_tx, p->port->uart_i2c, &p->cmd_buf[p->cmd_pos], size);
+                p->cmd_pos += size;
+                p->arg[0] = 0;
+                port_i2c_dma_start(p, size);
             } else if (p->mode == MODE_I2C) {
                 while(sercom(p->port->uart_i2c)->I2CM.SYNCBUSY.bit.SYSOP) {}
                 sercom(p->port->uart_i2c)->I2CM.DATA.reg = p->cmd_buf[p->cmd_pos];
@@ -566,17 +2790,32 @@ ExecStatus port_continue_cmd(PortData *p) {
                 // start dma transfer
                 // dma_sercom_start_rx(p->dma_rx, p->port->uart_i2c, NULL, size);
                 dma_sercom_start_tx(p->dma_tx, p->port->uart_i2c, &p->cmd_buf[p->cmd_pos], size);
+                port_uart_cts(p);
                 p->cmd_pos += size;
                 p->arg[0] -= size;
             }
             return EXEC_ASYNC;
         case CMD_RX:
+            if (p->mode == MODE_I2C && p->i2c_failed) {
+                // Keep the reply length of a failed transaction's reads
+                u32 size = port_rx_len(p);
+                memset(&p->reply_buf[p->reply_len], 0, size);
+                p->reply_len += size;
+                p->arg[0] -= size;
+                return p->arg[0] == 0 ? EXEC_DONE : EXEC_CONTINUE;
+            }
             if (p->mode == MODE_SPI) {
                 u32 size = port_rx_len(p);
                 dma_sercom_start_rx(p->dma_rx, p->port->spi, &p->reply_buf[p->reply_len], size);
                 dma_sercom_start_tx(p->dma_tx, p->port->spi, NULL, size);
                 p->reply_len += size;
                 p->arg[0] -= size;
+            } else if (p->mode == MODE_I2C && p->i2c_dma) {
+                u32 size = p->arg[0];
+                dma_sercom_start_rx(p->dma_rx, p->port->uart_i2c, &p->reply_buf[p->reply_len], size);
+                p->reply_len += size;
+                p->arg[0] = 0;
+                port_i2c_dma_start(p, size);
             } else if (p->mode == MODE_I2C) {
                 p->reply_buf[p->reply_len] = sercom(p->port->uart_i2c)->I2CM.DATA.reg;
                 sercom(p->port->uart_i2c)->I2CM.CTRLB.bit.ACKACT = 0;
@@ -597,6 +2836,49 @@ ExecStatus port_continue_cmd(PortData *p) {
                 p->arg[0] -= size;
             }
             return EXEC_ASYNC;
+        case CMD_PROG_LOAD: {
+            u32 size = port_tx_len(p);
+            memcpy(&p->prog_buf[p->prog_len], &p->cmd_buf[p->cmd_pos], size);
+            p->prog_len += size;
+            p->cmd_pos += size;
+            p->arg[0] -= size;
+            if (p->arg[0] == 0 && !port_prog_validate(p)) {
+                p->prog_len = 0;
+                port_error(p);
+            }
+            return p->arg[0] == 0 ? EXEC_DONE : EXEC_CONTINUE;
+        }
+        case CMD_I2C_READ_REG:
+            return port_i2c_read_reg_step(p);
+        case CMD_I2C_SCAN:
+            port_send_status(p, REPLY_DATA);
+            memset(&p->reply_buf[p->reply_len], 0, I2C_SCAN_SIZE);
+            p->reply_len += I2C_SCAN_SIZE;
+            p->arg[0] = I2C_SCAN_LAST + 1 - I2C_SCAN_FIRST;
+            p->arg[3] = 1;
+            port_i2c_scan_probe(p);
+            return EXEC_ASYNC;
+        case CMD_DAC_WAVE_LOAD: {
+            u16 remaining = ((p->arg[0] << 8) + p->arg[1]) - dac_wave.loaded;
+            u32 size = p->cmd_len - p->cmd_pos;
+            if (remaining < size) {
+                size = remaining;
+            }
+            memcpy((u8*) dac_wave.buf + dac_wave.loaded, &p->cmd_buf[p->cmd_pos], size);
+            dac_wave.loaded += size;
+            p->cmd_pos += size;
+            if (size < remaining) {
+                return EXEC_CONTINUE;
+            }
+            dac_wave.len = dac_wave.loaded / 2;
+            return EXEC_DONE;
+        }
+        case CMD_CAPTURE:
+            return port_capture_send(p) ? EXEC_DONE : EXEC_CONTINUE;
+        case CMD_PATTERN_LOAD:
+            return port_pattern_load_step(p);
+        case CMD_LED_STRIP:
+            return port_led_strip_step(p);
     }
     return EXEC_DONE;
 }
@@ -621,9 +2903,15 @@ bool port_rx_locked(PortData *p) {
     }
 }
 
+/// EIC flags of the pins whose interrupts are handled as they happen rather than as async events
+u32 port_reserved_interrupts(PortData* p) {
+    return p->prog_trigger | p->uart_cts | p->pin_events | p->pulse | p->counter | p->quad
+        | (logic_capture.owner == p ? logic_capture.trigger : 0);
+}
+
 /// Enable interrupts for async events
 void port_enable_async_events(PortData *p) {
-    EIC->INTENSET.reg = p->port->pin_interrupts;
+    EIC->INTENSET.reg = p->port->pin_interrupts & ~port_reserved_interrupts(p);
 
     // enable uart data getting copied
     if (p->mode == MODE_UART) {
@@ -633,7 +2921,7 @@ void port_enable_async_events(PortData *p) {
 
 /// Disable interrupts for async events
 void port_disable_async_events(PortData *p) {
-    EIC->INTENCLR.reg = p->port->pin_interrupts;
+    EIC->INTENCLR.reg = p->port->pin_interrupts & ~port_reserved_interrupts(p);
 
     // disable uart data getting copied
     if (p->mode == MODE_UART) {
@@ -643,7 +2931,12 @@ void port_disable_async_events(PortData *p) {
 
 /// Return true if the port is in a state where it can handle asyncronous events
 bool port_async_events_allowed(PortData* p) {
-    if (!p->pending_in) {
+    // The program's replies are framed, so async replies must wait for the iteration to end
+    if (p->prog_active) return false;
+
+    // Leave room for the largest async reply (a full frame of UART data) in the reply buffer being
+    // filled
+    if (p->reply_len + 255 + 2 <= BRIDGE_BUF_SIZE) {
         if (p->state == PORT_READ_CMD) return true;
 
         // TX doesn't touch reply_buf, so it is safe to process async events while it is sending.
@@ -653,6 +2946,136 @@ bool port_async_events_allowed(PortData* p) {
     return false;
 }
 
+/// Return true if the parser can make progress with the data in cmd_buf and space in reply_buf
+bool port_can_step(PortData* p) {
+    bool cmd_available = p->cmd_pos < p->cmd_len;
+
+    if (p->state == PORT_EXEC) {
+        bool reply_available = p->reply_len < BRIDGE_BUF_SIZE;
+        switch (p->cmd) {
+            case CMD_TX:
+                return cmd_available;
+            case CMD_RX:
+            case CMD_CAPTURE:
+                return reply_available;
+            case CMD_LED_STRIP:
+                // Wait for the other port to finish with the frame buffer
+                return cmd_available && (led_strip.owner == NULL || led_strip.owner == p);
+            case CMD_I2C_READ_REG:
+            case CMD_I2C_SCAN:
+                return !port_i2c_blocked(p);
+        }
+        return cmd_available && reply_available;
+    }
+
+    return cmd_available && p->reply_len + PORT_REPLY_RESERVE <= BRIDGE_BUF_SIZE;
+}
+
+/// Returns true if the remaining bytes of cmd_buf start with a command while the current command
+/// is in PORT_EXEC_ASYNC, i.e. the command has no payload left to read
+bool port_async_payload_done(PortData* p) {
+    switch (p->cmd) {
+        case CMD_ECHO:
+            return p->arg[0] == 0;
+        case CMD_TX:
+        case CMD_TXRX:
+            return p->arg[0] == 0 && port_long_remaining(p) == 0;
+        default:
+            return true;
+    }
+}
+
+/// While a command is in PORT_EXEC_ASYNC, execute the tagged immediate commands that directly
+/// follow it in cmd_buf, replying through express_buf. Any other command stops the lookahead so
+/// that untagged commands stay in order.
+void port_exec_tagged_lookahead(PortData* p) {
+    if (!port_async_payload_done(p)) {
+        return;
+    }
+
+    u8 cmd = p->cmd;
+    u8 arg[BRIDGE_ARG_SIZE];
+    memcpy(arg, p->arg, sizeof(arg));
+    u8* reply_buf = p->reply_buf;
+    u16 reply_len = p->reply_len;
+
+    while (!p->pending_in_express && p->express_len + PORT_REPLY_RESERVE <= PORT_EXPRESS_SIZE
+           && p->cmd_pos + 2 < p->cmd_len
+           && p->cmd_buf[p->cmd_pos] == CMD_TAG
+           && port_cmd_is_immediate(p->cmd_buf[p->cmd_pos + 2])) {
+        u8 tag = p->cmd_buf[p->cmd_pos + 1];
+        p->cmd = p->cmd_buf[p->cmd_pos + 2];
+        u8 arg_len = port_cmd_args(p->cmd);
+        if (p->cmd_pos + 3 + arg_len > p->cmd_len) {
+            break;
+        }
+        memcpy(p->arg, &p->cmd_buf[p->cmd_pos + 3], arg_len);
+        p->cmd_pos += 3 + arg_len;
+
+        p->reply_buf = p->express_buf;
+        p->reply_len = p->express_len;
+        port_send_status(p, REPLY_TAGGED);
+        port_send_status(p, tag);
+        port_begin_cmd(p);
+        if (!port_cmd_has_reply(p->cmd)) {
+            port_send_status(p, REPLY_ACK);
+        }
+        p->express_len = p->reply_len;
+    }
+
+    p->cmd = cmd;
+    memcpy(p->arg, arg, sizeof(arg));
+    p->reply_buf = reply_buf;
+    p->reply_len = reply_len;
+}
+
+/// Move the bridge buffers along their rings: queue a finished reply buffer, send the oldest
+/// queued reply, release the consumed command buffer, and request the next one.
+void port_step_buffers(PortData* p) {
+    // If the reply buffer is full, queue it.
+    // Or, if there is any data other than program replies held for a batch and the command buffer
+    // has been processed, might as well queue it.
+    // A free buffer must remain to fill next, and a program iteration's replies are not split.
+    bool full = p->reply_len + PORT_REPLY_RESERVE > BRIDGE_BUF_SIZE || port_prog_blocked(p)
+        || port_i2c_blocked(p);
+    bool idle = p->cmd_pos >= p->cmd_len && p->reply_len > p->prog_held;
+    if ((full || idle) && p->reply_count < PORT_RING_SIZE - 1 && !p->prog_active
+       && !(p->state == PORT_EXEC_ASYNC && port_rx_locked(p))) {
+        u8 slot = (p->reply_head + p->reply_count) % PORT_RING_SIZE;
+        p->reply_lens[slot] = p->reply_len;
+        p->reply_count++;
+        p->reply_buf = p->reply_ring[(slot + 1) % PORT_RING_SIZE];
+        p->reply_len = 0;
+        p->prog_held = 0;
+    }
+
+    // Send out-of-order tagged replies, then the oldest queued reply buffer
+    if (p->express_len > 0 && !p->pending_in) {
+        p->pending_in = true;
+        p->pending_in_express = true;
+        port_bridge_start_in(p, p->express_buf, p->express_len);
+    } else if (p->reply_count > 0 && !p->pending_in) {
+        p->pending_in = true;
+        port_bridge_start_in(p, p->reply_ring[p->reply_head], p->reply_lens[p->reply_head]);
+    }
+
+    // If the command buffer has been processed, move on to the next received one
+    if (p->cmd_count > 0 && p->cmd_pos >= p->cmd_len && !p->prog_active
+       && !(p->state == PORT_EXEC_ASYNC && port_tx_locked(p))) {
+        p->cmd_head = (p->cmd_head + 1) % PORT_RING_SIZE;
+        p->cmd_count--;
+        p->cmd_buf = p->cmd_ring[p->cmd_head];
+        p->cmd_len = p->cmd_count > 0 ? p->cmd_lens[p->cmd_head] : 0;
+        p->cmd_pos = 0;
+    }
+
+    // Receive into the next free command buffer
+    if (p->cmd_count < PORT_RING_SIZE && !p->pending_out) {
+        p->pending_out = true;
+        port_bridge_start_out(p, p->cmd_ring[(p->cmd_head + p->cmd_count) % PORT_RING_SIZE]);
+    }
+}
+
 /// Step the state machine. This is the main dispatch function of the port control logic.
 /// This gets called after an event occurs to decide what happens next.
 void port_step(PortData* p) {
@@ -664,22 +3087,58 @@ void port_step(PortData* p) {
     port_disable_async_events(p);
 
     while (1) {
-        // If the command buffer has been processed, request a new one
-        if (p->cmd_pos >= p->cmd_len && !p->pending_out && !(p->state == PORT_EXEC_ASYNC && port_tx_locked(p))) {
-            p->pending_out = true;
-            port_bridge_start_out(p, p->cmd_buf);
-        }
-        // If the reply buffer is full, flush it.
-        // Or, if there is any data and no commands, might as well flush.
-        if ((p->reply_len >= BRIDGE_BUF_SIZE || (p->pending_out && p->reply_len > 0))
-           && !p->pending_in && !(p->state == PORT_EXEC_ASYNC && port_rx_locked(p))) {
-            p->pending_in = true;
-            port_bridge_start_in(p, p->reply_buf, p->reply_len);
-        }
-
-        // Wait for bridge transfers to complete;
-        // TODO: multiple-buffer FIFO
-        if (p->pending_in || p->pending_out) {
+        // Continue a long-form transfer with its next chunk
+        if (p->state == PORT_READ_CMD && port_long_remaining(p) > 0) {
+            port_long_next(p);
+            p->state = PORT_EXEC;
+        }
+
+        if (p->cmd_tagged && p->state == PORT_READ_CMD) {
+            port_finish_tagged_cmd(p);
+        }
+
+        if (p->prog_active && p->state == PORT_READ_CMD && p->cmd_pos >= p->cmd_len) {
+            port_prog_end(p);
+        }
+
+        if (p->state == PORT_EXEC_ASYNC) {
+            port_exec_tagged_lookahead(p);
+        }
+
+        port_step_buffers(p);
+
+        if (p->state == PORT_EXEC_ASYNC) {
+            break;
+        }
+
+        // Start a due program iteration between commands, once its replies fit in reply_buf
+        if (p->prog_due && p->state == PORT_READ_CMD && !p->prog_active && !p->tag_pending
+           && !port_prog_blocked(p)) {
+            port_prog_begin(p);
+        }
+
+        // Wait for bridge transfers to provide commands or reply space
+        if (!port_can_step(p)) {
+            if (port_async_events_allowed(p) && port_adc_stream_pending(p)) {
+                port_adc_stream_send(p);
+                continue;
+            }
+
+            if (port_async_events_allowed(p) && port_dac_wave_pending(p)) {
+                port_dac_wave_send_end(p);
+                continue;
+            }
+
+            if (port_async_events_allowed(p) && port_pattern_pending(p)) {
+                port_pattern_send_end(p);
+                continue;
+            }
+
+            if (port_async_events_allowed(p) && port_pin_events_pending(p)) {
+                port_pin_events_send(p);
+                continue;
+            }
+
             if (port_async_events_allowed(p)) {
                 // If we're waiting for further commands, also
                 // wait for async events.
@@ -697,7 +3156,7 @@ void port_step(PortData* p) {
                 p->arg_pos = 0;
                 p->state = PORT_READ_ARG;
             } else {
-                p->state = port_begin_cmd(p);
+                p->state = port_start_cmd(p);
             }
         } else if (p->state == PORT_READ_ARG) {
             // Read an argument byte
@@ -709,31 +3168,55 @@ void port_step(PortData* p) {
             p->arg_len--;
 
             if (p->arg_len == 0) {
-                p->state = port_begin_cmd(p);
+                p->state = port_start_cmd(p);
             }
         } else if (p->state == PORT_EXEC) {
             p->state = port_continue_cmd(p);
-        } else if (p->state == PORT_EXEC_ASYNC) {
-            break;
         }
     }
 }
 
-void port_bridge_out_completion(PortData* p, u8 len) {
+void port_bridge_out_completion(PortData* p, u16 len) {
     p->pending_out = false;
-    p->cmd_len = len;
-    p->cmd_pos = 0;
+    p->cmd_lens[(p->cmd_head + p->cmd_count) % PORT_RING_SIZE] = len;
+    if (p->cmd_count == 0 && !p->prog_active) {
+        // Received into the head slot, which the parser is waiting on
+        p->cmd_len = len;
+        p->cmd_pos = 0;
+    }
+    p->cmd_count++;
     port_step(p);
 }
 
 void port_bridge_in_completion(PortData* p) {
     p->pending_in = false;
-    p->reply_len = 0;
+    if (p->mode == MODE_UART) {
+        port_uart_rts(p);
+    }
+    if (p->pending_in_express) {
+        p->pending_in_express = false;
+        p->express_len = 0;
+    } else {
+        p->reply_head = (p->reply_head + 1) % PORT_RING_SIZE;
+        p->reply_count--;
+    }
     port_step(p);
 }
 
 void port_dma_rx_completion(PortData* p) {
-    if (p->state == PORT_EXEC_ASYNC) {
+    if (p->mode == MODE_UART) {
+        port_uart_half_completion(p);
+    } else if (logic_capture.owner == p && p->state == PORT_EXEC_ASYNC) {
+        port_capture_completion(p);
+    } else if (pattern.owner == p) {
+        port_pattern_completion(p);
+    } else if (led_strip.owner == p && p->state == PORT_EXEC_ASYNC) {
+        port_led_strip_completion(p);
+    } else if (p->state == PORT_EXEC_ASYNC) {
+        if (p->mode == MODE_SPI && p->arg[0] == 0 && port_long_remaining(p) == 0
+           && !p->spi_cs_hold) {
+            port_spi_cs(p, false);
+        }
         p->state = (p->arg[0] == 0 ? EXEC_DONE : EXEC_CONTINUE);
         port_step(p);
     } else {
@@ -743,6 +3226,12 @@ void port_dma_rx_completion(PortData* p) {
 }
 
 void port_dma_tx_completion(PortData* p) {
+    if (p->mode == MODE_I2C && p->state == PORT_EXEC_ASYNC) {
+        // The last byte is still being sent; finish when it is acknowledged
+        sercom(p->port->uart_i2c)->I2CM.INTENSET.reg = SERCOM_I2CM_INTENSET_MB;
+        return;
+    }
+
     if (p->state == PORT_EXEC_ASYNC) {
         p->state = (p->arg[0] == 0 ? EXEC_DONE : EXEC_CONTINUE);
         port_step(p);
@@ -754,51 +3243,141 @@ void port_dma_tx_completion(PortData* p) {
 
 void port_handle_sercom_uart_i2c(PortData* p) {
     if (p->mode == MODE_UART) {
-        if (sercom(p->port->uart_i2c)->USART.INTFLAG.reg & SERCOM_USART_INTFLAG_RXC) {
-            sercom(p->port->uart_i2c)->USART.INTFLAG.reg = SERCOM_USART_INTFLAG_RXC;
-
-            // reset timeout
-            tcc_delay_start(p->tcc_channel, 200*10);
-
-            // Read data and push into buffer
-            p->uart_buf.rx[p->uart_buf.head] = sercom(p->port->uart_i2c)->USART.DATA.reg;
-            p->uart_buf.head = (p->uart_buf.head + 1) % UART_RX_SIZE;
-
-            if (p->uart_buf.buf_len < UART_RX_SIZE) {
-                p->uart_buf.buf_len++;
-            } else {
-                // Buffer full. Drop the oldest byte.
-                p->uart_buf.tail = (p->uart_buf.tail + 1) % UART_RX_SIZE;
-            }
-
-            // If the buffer is almost full and we're in a safe state, flush it immediately
-            if (p->uart_buf.buf_len > (UART_RX_SIZE - 4) && port_async_events_allowed(p)) {
-                uart_send_data(p);
+        // Received data is copied by DMA; only errors interrupt
+        if (sercom(p->port->uart_i2c)->USART.INTFLAG.reg & SERCOM_USART_INTFLAG_ERROR) {
+            sercom(p->port->uart_i2c)->USART.INTFLAG.reg = SERCOM_USART_INTFLAG_ERROR;
+            if (sercom(p->port->uart_i2c)->USART.STATUS.bit.BUFOVF
+               && p->uart_buf.overflows < 0xFFFF) {
+                p->uart_buf.overflows++;
             }
+            sercom(p->port->uart_i2c)->USART.STATUS.reg
+                = SERCOM_USART_STATUS_BUFOVF
+                | SERCOM_USART_STATUS_FERR
+                | SERCOM_USART_STATUS_PERR;
         }
     } else if (p->mode == MODE_I2C) {
         // interrupt on i2c flag
-        if (sercom(p->port->uart_i2c)->I2CM.INTFLAG.bit.ERROR) {
-            // TODO: signal errors in a less-destructive way e.g. for bus scanning
-            port_error(p);
-        }
+        u8 result = port_i2c_result(p);
 
         sercom(p->port->uart_i2c)->I2CM.INTFLAG.reg = SERCOM_I2CM_INTFLAG_SB | SERCOM_I2CM_INTFLAG_MB;
         sercom(p->port->uart_i2c)->I2CM.INTENCLR.reg = SERCOM_I2CM_INTFLAG_SB | SERCOM_I2CM_INTFLAG_MB;
-        if (p->state == PORT_EXEC_ASYNC) {
-            p->state = (p->arg[0] == 0 ? EXEC_DONE : EXEC_CONTINUE);
-            port_step(p);
-        } else {
-            port_error(p);
+        if (p->state != PORT_EXEC_ASYNC) {
+            // Bus errors between transactions are left for the next one to run into
+            if (result == REPLY_ACK) {
+                port_error(p);
+            }
+            return;
+        }
+
+        if (p->cmd == CMD_I2C_SCAN) {
+            port_i2c_scan_result(p, result);
             return;
         }
+
+        // Bytes of a DMA read only come from the SERCOM's DMA request, so MB means the NACK of the
+        // address
+        if (p->i2c_dma && (p->cmd == CMD_RX || p->cmd == CMD_I2C_READ_REG)) {
+            result = REPLY_NACK;
+        }
+
+        if (result != REPLY_ACK) {
+            port_i2c_fail(p, result);
+        }
+        p->state = (p->arg[0] == 0 ? EXEC_DONE : EXEC_CONTINUE);
+        port_step(p);
     } else {
         port_error(p);
         return;
     }
 }
 
+void port_handle_tc(PortData *p) {
+    tc(p->tc_channel)->COUNT16.INTFLAG.reg = TC_INTFLAG_OVF;
+
+    if (p->counter) {
+        p->counter_overflows++;
+        return;
+    }
+
+    // Periods that end before the previous iteration has started are coalesced
+    if (p->prog_running) {
+        p->prog_due = true;
+        port_step(p);
+    }
+}
+
+void port_handle_systick(PortData *p) {
+    if (p->pulse && --p->pulse_timeout == 0) {
+        port_pulse_finish(p, false, 0);
+    }
+
+    if (logic_capture.owner == p && logic_capture.waiting) {
+        if (dma_remaining(p->dma_rx) < logic_capture.count) {
+            // Sampling has started
+            logic_capture.waiting = false;
+        } else if (--logic_capture.timeout == 0) {
+            port_capture_stop(p);
+            logic_capture.owner = NULL;
+            port_send_status(p, REPLY_TIMEOUT);
+            port_exec_async_complete(p, EXEC_DONE);
+        }
+    }
+}
+
 void port_handle_extint(PortData *p, u32 flags) {
+    if (flags & p->quad) {
+        EIC->INTFLAG.reg = flags & p->quad;
+        flags &= ~p->quad;
+        port_quad_edge(p);
+
+        if (!(flags & p->port->pin_interrupts)) {
+            return;
+        }
+    }
+
+    if (flags & p->pulse) {
+        EIC->INTFLAG.reg = p->pulse;
+        flags &= ~p->pulse;
+        port_pulse_edge(p);
+
+        if (!(flags & p->port->pin_interrupts)) {
+            return;
+        }
+    }
+
+    if (flags & p->uart_cts) {
+        EIC->INTFLAG.reg = p->uart_cts;
+        port_uart_cts(p);
+
+        flags &= ~p->uart_cts;
+        if (!(flags & p->port->pin_interrupts)) {
+            return;
+        }
+    }
+
+    if (flags & p->prog_trigger) {
+        EIC->INTFLAG.reg = p->prog_trigger;
+        if (p->prog_running) {
+            p->prog_due = true;
+        }
+
+        flags &= ~p->prog_trigger;
+        if (!(flags & p->port->pin_interrupts)) {
+            port_step(p);
+            return;
+        }
+    }
+
+    if (flags & p->pin_events) {
+        port_pin_events_record(p, flags & p->pin_events);
+
+        flags &= ~p->pin_events;
+        if (!(flags & p->port->pin_interrupts)) {
+            port_step(p);
+            return;
+        }
+    }
+
     if (p->state == PORT_READ_CMD) {
         // Async event
         for (int pin = 0; pin<8; pin++) {
@@ -101,7 +101,7 @@ void pipe_bridge_in_completion() {
 }
 
 // Received from bridge, send to USB
-void pipe_bridge_out_completion(u8 count) {
+void pipe_bridge_out_completion(u16 count) {
     if (pipe_state_soc_to_pc == PIPE_WAIT_FOR_BRIDGE) {
         usb_ep_start_in(USB_EP_PIPE_IN, pipe_buffer_soc_to_pc, count, false);
         pipe_state_soc_to_pc = PIPE_WAIT_FOR_USB;
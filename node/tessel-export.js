@@ -36,6 +36,14 @@ const PWM_MAX_PERIOD = 0xFFFF;
 const PWM_MAX_FREQUENCY = 5000;
 const PWM_MIN_FREQUENCY = 1;
 const PWM_PRESCALARS = [1, 2, 4, 8, 16, 64, 256, 1024];
+// Maximum length of a program stored on the coprocessor
+const PROGRAM_MAX_LENGTH = 255;
+
+// Longest transfer of a single TX, RX or TXRX command. Transfers longer
+// than 255 bytes use the commands' 16-bit length forms.
+const TRANSFER_MAX_LENGTH = 0xFFFF;
+// Maximum number of samples in a waveform played on the DAC
+const WAVEFORM_MAX_LENGTH = 256;
 // Maximum number of unscaled ticks in a second (48 MHz)
 const SAMD21_TICKS_PER_SECOND = 48000000;
 // GPIO number of RESET pin
@@ -46,6 +54,19 @@ const ADC_PINS = [4, 7];
 const INT_PINS = [2, 5, 6, 7];
 const PULL_PINS = [2, 3, 4, 5, 6, 7];
 const PWM_PINS = [5, 6];
+const UART_PINS = [5, 6];
+
+// CMD.SPI_CS flags, after the chip select's pin number
+const SPI_CS_ACTIVE_HIGH = 1 << 3;
+const SPI_CS_HOLD = 1 << 6;
+const SPI_CS_ENABLE = 1 << 7;
+
+// CMD.UART_FLOW flags, after the RTS and CTS pin numbers
+const UART_RTS = 1 << 6;
+const UART_CTS = 1 << 7;
+
+// CMD.QUAD_START flag, after the encoder's pin numbers
+const QUAD_ENABLE = 1 << 7;
 
 const INT_MODES = {
   rise: 1,
@@ -61,6 +82,36 @@ const PULL_MODES = {
   none: 2,
 };
 
+const PULSE_MODES = {
+  high: 0,
+  low: 1,
+  period: 2,
+};
+
+// Longest wait for a pulse or a capture trigger, in milliseconds
+const PULSE_TIMEOUT_MAX = 0xFFFF;
+
+// Samples that fit in the coprocessor's capture buffer. Port A's pins are
+// spread over more of the SAMD21's PORT registers, which take more bytes
+// per sample.
+const CAPTURE_MAX_SAMPLES = {
+  A: 1638,
+  B: 4096,
+};
+// Fastest sample rate the DMA keeps up with
+const CAPTURE_MAX_FREQUENCY = 4e6;
+// Steps that fit in the coprocessor's pattern table, which like the
+// capture buffer takes more bytes per step on port A
+const PATTERN_MAX_STEPS = {
+  A: 409,
+  B: 1024,
+};
+const PATTERN_MAX_FREQUENCY = 4e6;
+// Bytes of color data in one frame of an LED strip: 512 RGB LEDs
+const LED_STRIP_MAX_LENGTH = 1536;
+// SPI clock at which the coprocessor's 3 bit encoding meets WS2812 timing
+const LED_STRIP_CLOCK = 2.4e6;
+
 const CMD = {
   NOP: 0,
   FLUSH: 1,
@@ -90,6 +141,40 @@ const CMD = {
   STOP: 20,
   PWM_DUTY_CYCLE: 27,
   PWM_PERIOD: 28,
+  TAG: 29,
+  PROG_LOAD: 30,
+  PROG_RUN: 31,
+  PROG_STOP: 32,
+  PROG_TRIGGER: 33,
+  ADC_STREAM_START: 34,
+  ADC_STREAM_STOP: 35,
+  DAC_WAVE_LOAD: 36,
+  DAC_WAVE_PLAY: 37,
+  DAC_WAVE_STOP: 38,
+  I2C_READ_REG: 39,
+  I2C_STATUS: 40,
+  I2C_SCAN: 41,
+  SPI_CS: 42,
+  TX_LONG: 43,
+  RX_LONG: 44,
+  TXRX_LONG: 45,
+  UART_STATUS: 46,
+  UART_FLOW: 47,
+  GPIO_READ_ALL: 48,
+  GPIO_WRITE_MASK: 49,
+  GPIO_DIR_MASK: 50,
+  GPIO_EVENTS: 51,
+  GPIO_PULSE: 52,
+  CAPTURE_TRIGGER: 53,
+  CAPTURE: 54,
+  PATTERN_LOAD: 55,
+  PATTERN_PLAY: 56,
+  PATTERN_STOP: 57,
+  COUNTER_START: 58,
+  COUNTER_READ: 59,
+  QUAD_START: 60,
+  QUAD_READ: 61,
+  LED_STRIP: 62,
 };
 
 const REPLY = {
@@ -98,10 +183,22 @@ const REPLY = {
   HIGH: 0x82,
   LOW: 0x83,
   DATA: 0x84,
+  TAGGED: 0x85,
+  I2C_BUS_ERROR: 0x86,
+  I2C_ARB_LOST: 0x87,
+  TIMEOUT: 0x88,
+  BUSY: 0x89,
 
   MIN_ASYNC: 0xA0,
+  ASYNC_PROG_END: 0xA1,
+  ASYNC_ADC_OVERRUN: 0xA2,
+  ASYNC_DAC_WAVE_END: 0xA3,
+  ASYNC_PATTERN_END: 0xA4,
   ASYNC_PIN_CHANGE_N: 0xC0, // c0 to c8 is all async pin assignments
-  ASYNC_UART_RX: 0xD0
+  ASYNC_UART_RX: 0xD0,
+  ASYNC_PROG_DATA: 0xD1,
+  ASYNC_ADC_DATA: 0xD2,
+  ASYNC_PIN_EVENTS: 0xD3,
 };
 
 class Tessel {
@@ -346,6 +443,27 @@ class Port extends EventEmitter {
 
     let replyBuf = new Buffer(0);
 
+    // Dispatch an interrupt of pin `index` at level `value`. `time` is the
+    // time of the edge in microseconds, if the coprocessor recorded it.
+    const pinInterrupt = (index, value, time) => {
+      const pin = this.pin[index];
+      // Get the mode change
+      const mode = pin.interruptMode;
+
+      // For one-time 'low' or 'high' event
+      if (mode === 'low' || mode === 'high') {
+        pin.emit(mode, time);
+        // Reset the pin interrupt state (prevent constant interrupts)
+        pin.interruptMode = null;
+        // Decrement the number of tasks waiting on the socket
+        this.unref();
+      } else {
+        // Emit the change and rise or fall
+        pin.emit('change', value, time);
+        pin.emit(value ? 'rise' : 'fall', time);
+      }
+    };
+
     this.sock.on('readable', () => {
       let queued;
       // This value can potentially be `null`.
@@ -381,30 +499,94 @@ class Port extends EventEmitter {
           } else {
             break;
           }
+          // If the next byte is the start of a program iteration's replies
+        } else if (byte === REPLY.ASYNC_PROG_DATA) {
+          // Wait for the 16-bit length and the replies
+          if (replyBuf.length < 3 || replyBuf.length < 3 + replyBuf.readUInt16BE(1)) {
+            break;
+          }
+
+          const length = replyBuf.readUInt16BE(1);
+          const data = replyBuf.slice(3, 3 + length);
+          replyBuf = replyBuf.slice(3 + length);
+
+          this.emit('program-data', data);
+          // If the next byte is the start of a block of analog stream samples
+        } else if (byte === REPLY.ASYNC_ADC_DATA) {
+          // Wait for the 16-bit length and the samples
+          if (replyBuf.length < 3 || replyBuf.length < 3 + replyBuf.readUInt16BE(1)) {
+            break;
+          }
+
+          const length = replyBuf.readUInt16BE(1);
+          const data = replyBuf.slice(3, 3 + length);
+          replyBuf = replyBuf.slice(3 + length);
+
+          // Samples are little endian and interleaved in pin order
+          const pins = this.analogStreamPins.length;
+          const rounds = [];
+          for (let offset = 0; offset + pins * 2 <= data.length; offset += pins * 2) {
+            const round = [];
+            for (let i = 0; i < pins; i++) {
+              round.push(data.readUInt16LE(offset + i * 2) / ANALOG_RESOLUTION);
+            }
+            rounds.push(round);
+          }
+
+          this.emit('analog-data', rounds);
+          // If the next byte is the start of a batch of timestamped pin events
+        } else if (byte === REPLY.ASYNC_PIN_EVENTS) {
+          // Wait for the event count, the dropped count and the events
+          if (replyBuf.length < 4 || replyBuf.length < 4 + replyBuf[1] * 5) {
+            break;
+          }
+
+          const count = replyBuf[1];
+          const dropped = replyBuf.readUInt16BE(2);
+          const events = replyBuf.slice(4, 4 + count * 5);
+          replyBuf = replyBuf.slice(4 + count * 5);
+
+          if (dropped) {
+            this.emit('pin-events-dropped', dropped);
+          }
+
+          // Each event is the pin number with its value in bit 3, and the
+          // time in microseconds
+          for (let offset = 0; offset < events.length; offset += 5) {
+            const byte = events[offset];
+            pinInterrupt(byte & 0x7, (byte >> 3) & 1, events.readUInt32BE(offset + 1));
+          }
           // This is some other async transaction
         } else if (byte >= REPLY.MIN_ASYNC) {
           // If this is a pin change
           if (byte >= REPLY.ASYNC_PIN_CHANGE_N && byte < REPLY.ASYNC_PIN_CHANGE_N + 16) {
             // Pull out the pin number (requires clearing the value bit)
-            const pin = this.pin[(byte - REPLY.ASYNC_PIN_CHANGE_N) & ~(1 << 3)];
-            // Get the mode change
-            const mode = pin.interruptMode;
-            // Get the pin value
-            const pinValue = (byte >> 3) & 1;
-
-            // For one-time 'low' or 'high' event
-            if (mode === 'low' || mode === 'high') {
-              pin.emit(mode);
-              // Reset the pin interrupt state (prevent constant interrupts)
-              pin.interruptMode = null;
-              // Decrement the number of tasks waiting on the socket
+            // and the pin value
+            pinInterrupt((byte - REPLY.ASYNC_PIN_CHANGE_N) & ~(1 << 3), (byte >> 3) & 1);
+
+          } else if (byte === REPLY.ASYNC_ADC_OVERRUN) {
+            // The host didn't keep up and a block of samples was dropped
+            this.emit('analog-overrun');
+          } else if (byte === REPLY.ASYNC_DAC_WAVE_END) {
+            // A waveform played without looping has finished
+            const pin = this.pin[7];
+            if (pin.waveformPlaying) {
+              pin.waveformPlaying = false;
               this.unref();
-            } else {
-              // Emit the change and rise or fall
-              pin.emit('change', pinValue);
-              pin.emit(pinValue ? 'rise' : 'fall');
             }
-
+            pin.emit('waveform-end');
+          } else if (byte === REPLY.ASYNC_PATTERN_END) {
+            // A pattern played without looping has finished
+            if (this.patternPlaying) {
+              this.patternPlaying = false;
+              this.unref();
+            }
+            this.emit('pattern-end');
+          } else if (byte === REPLY.ASYNC_PROG_END) {
+            // The program ran the requested number of iterations
+            this.programRunning = false;
+            this.unref();
+            this.emit('program-end');
           } else {
             // Some other async event
             this.emit('async-event', byte);
@@ -412,6 +594,46 @@ class Port extends EventEmitter {
 
           // Cut this byte off of the reply buffer
           replyBuf = replyBuf.slice(1);
+          // This is the reply to a tagged command, which may arrive out of order
+        } else if (byte === REPLY.TAGGED) {
+          // Wait for the tag and the reply byte
+          if (replyBuf.length < 3) {
+            break;
+          }
+
+          const tag = replyBuf[1];
+          const reply = replyBuf[2];
+          queued = this.tags.get(tag);
+
+          if (!queued) {
+            throw new Error(`Received response for unknown tag: ${tag}`);
+          }
+
+          let length = 3;
+          let data = reply;
+
+          if (reply === REPLY.DATA) {
+            if (!queued.size) {
+              throw new Error('Received unexpected data packet');
+            }
+
+            // Wait for all of the data bytes
+            if (replyBuf.length < 3 + queued.size) {
+              break;
+            }
+
+            data = replyBuf.slice(3, 3 + queued.size);
+            length += queued.size;
+          }
+
+          replyBuf = replyBuf.slice(length);
+          this.tags.delete(tag);
+          this.unref();
+
+          /* istanbul ignore else */
+          if (queued.callback) {
+            queued.callback.call(this, replyError(reply), data);
+          }
         } else {
           // If there are no commands awaiting a response
           if (this.replyQueue.length === 0) {
@@ -465,6 +687,15 @@ class Port extends EventEmitter {
                 // Return the byte in the callback
                 queued.callback.call(this, null, byte);
               }
+            } else if (byte === REPLY.ACK || replyError(byte)) {
+              // A status reply, in place of any data on failure
+              replyBuf = replyBuf.slice(1);
+              queued = this.dequeue();
+
+              /* istanbul ignore else */
+              if (queued.callback) {
+                queued.callback.call(this, replyError(byte), byte);
+              }
             }
           }
         }
@@ -477,6 +708,24 @@ class Port extends EventEmitter {
     // Array of {size, callback} used to dispatch replies
     this.replyQueue = [];
 
+    // When true, reads are sent as tagged commands so that the
+    // coprocessor can complete them out of order, e.g. a pin read
+    // issued while a long SPI transfer is still in flight.
+    this.tagged = false;
+
+    // Map of tag => {size, callback} for tagged commands awaiting a reply
+    this.tags = new Map();
+    this.nextTag = 0;
+
+    // True while a program started by runProgram is scheduled
+    this.programRunning = false;
+
+    // True while a pattern started by playPattern is playing
+    this.patternPlaying = false;
+
+    // Pins sampled by the analog stream, in the order of its samples
+    this.analogStreamPins = [];
+
     this.pin = [];
     for (let i = 0; i < 8; i++) {
       this.pin.push(new Tessel.Pin(i, this));
@@ -603,6 +852,36 @@ class Port extends EventEmitter {
     return this.replyQueue.shift();
   }
 
+  // Write a command whose reply is dispatched to `reply`, tagging it
+  // when `this.tagged` is set
+  request(data, reply) {
+    this.cork();
+    if (this.tagged) {
+      this.sock.write(new Buffer([CMD.TAG, this.allocateTag(reply)]));
+    } else {
+      this.enqueue(reply);
+    }
+    this.sock.write(new Buffer(data));
+    this.uncork();
+  }
+
+  allocateTag(reply) {
+    if (this.tags.size > 0xFF) {
+      throw new Error('Too many tagged commands in flight');
+    }
+
+    while (this.tags.has(this.nextTag)) {
+      this.nextTag = (this.nextTag + 1) & 0xFF;
+    }
+
+    const tag = this.nextTag;
+    this.nextTag = (this.nextTag + 1) & 0xFF;
+
+    this.ref();
+    this.tags.set(tag, reply);
+    return tag;
+  }
+
   cork() {
     this.sock.cork();
   }
@@ -629,8 +908,7 @@ class Port extends EventEmitter {
   }
 
   status(data, callback) {
-    this.sock.write(new Buffer(data));
-    this.enqueue({
+    this.request(data, {
       size: 0,
       callback,
     });
@@ -646,26 +924,414 @@ class Port extends EventEmitter {
 
     this.cork();
 
-    // The protocol only supports <256 byte transfers, chunk if data is bigger
+    // A command transfers at most 65535 bytes, chunk if data is bigger
     while (offset < data.length) {
-      chunk = data.slice(offset, offset + 255);
+      chunk = data.slice(offset, offset + TRANSFER_MAX_LENGTH);
 
-      this.sock.write(new Buffer([CMD.TX, chunk.length]));
+      this.sock.write(transferHeader(CMD.TX, chunk.length));
       this.sock.write(chunk);
 
-      offset += 255;
+      offset += TRANSFER_MAX_LENGTH;
+    }
+
+    this.sync(callback);
+    this.uncork();
+  }
+
+  // Store a program on the coprocessor: a sequence of port commands
+  // (with their payloads) to run on its own timer. Replies of each
+  // iteration are emitted as one 'program-data' Buffer.
+  loadProgram(program, callback) {
+    if (program.length === 0 || program.length > PROGRAM_MAX_LENGTH) {
+      throw new RangeError(`Program length must be within 1-${PROGRAM_MAX_LENGTH}`);
+    }
+
+    this.cork();
+    this.sock.write(new Buffer([CMD.PROG_LOAD, program.length]));
+    this.sock.write(new Buffer(program));
+    this.sync(callback);
+    this.uncork();
+  }
+
+  // Run the stored program every `interval` milliseconds, `count` times
+  // (0 runs it until stopProgram), sending the replies of `batch`
+  // iterations at a time.
+  runProgram(options, callback) {
+    const interval = options.interval;
+    const count = options.count || 0;
+    const batch = options.batch || 1;
+
+    if (!(interval > 0)) {
+      throw new RangeError('Program interval must be greater than 0');
+    }
+
+    if (count < 0 || count > 0xFFFF) {
+      throw new RangeError('Program count must be within 0-65535');
+    }
+
+    if (batch < 1 || batch > 0xFF) {
+      throw new RangeError('Program batch must be within 1-255');
+    }
+
+    const results = determineDutyCycleAndPrescalar(1000 / interval);
+
+    if (!this.programRunning) {
+      this.programRunning = true;
+      this.ref();
+    }
+
+    this.command([
+      CMD.PROG_RUN,
+      results.prescalarIndex,
+      results.period >> 8, results.period & 0xFF,
+      count >> 8, count & 0xFF,
+      batch,
+    ], callback);
+  }
+
+  // Run the stored program each time `pin` interrupts with `mode`
+  // ('rise', 'fall', 'change', 'high' or 'low'), e.g. on a sensor's
+  // data-ready line. The program runs on the coprocessor as soon as
+  // the interrupt occurs, without a round trip through the host.
+  // `count` and `batch` are as for runProgram.
+  triggerProgram(pin, mode, options, callback) {
+    const count = options.count || 0;
+    const batch = options.batch || 1;
+
+    if (INT_PINS.indexOf(pin) === -1) {
+      throw new RangeError(`Programs can only be triggered by pins ${INT_PINS.join(', ')}`);
+    }
+
+    if (!INT_MODES[mode]) {
+      throw new RangeError(`Invalid trigger mode. Must be one of: ${Object.keys(INT_MODES).join(', ')}`);
+    }
+
+    if (count < 0 || count > 0xFFFF) {
+      throw new RangeError('Program count must be within 0-65535');
+    }
+
+    if (batch < 1 || batch > 0xFF) {
+      throw new RangeError('Program batch must be within 1-255');
+    }
+
+    if (!this.programRunning) {
+      this.programRunning = true;
+      this.ref();
+    }
+
+    this.command([
+      CMD.PROG_TRIGGER,
+      pin | (INT_MODES[mode] << 4),
+      count >> 8, count & 0xFF,
+      batch,
+    ], callback);
+  }
+
+  stopProgram(callback) {
+    if (this.programRunning) {
+      this.programRunning = false;
+      this.unref();
+    }
+
+    this.command([CMD.PROG_STOP], callback);
+  }
+
+  // Sample `pins` with the ADC `frequency` times a second each, paced by
+  // the coprocessor's timer. Samples arrive in blocks as 'analog-data'
+  // events: an array of rounds, each an array of values (0-1) for the
+  // pins in ascending order. There is one ADC, so an analog stream on
+  // either port or a single analogRead stops the stream.
+  startAnalogStream(pins, frequency, callback) {
+    if (!Array.isArray(pins) || pins.length === 0) {
+      throw new RangeError('An analog stream needs at least one pin');
+    }
+
+    pins = pins.slice().sort((a, b) => a - b);
+
+    let mask = 0;
+    pins.forEach(pin => {
+      if (!this.pin[pin] || !this.pin[pin].supports.ADC) {
+        throw new RangeError(`Analog streams are not supported on pin ${pin}`);
+      }
+      mask |= 1 << pin;
+    });
+
+    if (!(frequency > 0)) {
+      throw new RangeError('Analog stream frequency must be greater than 0');
+    }
+
+    // Each timer period converts one pin
+    const results = determineDutyCycleAndPrescalar(frequency * pins.length);
+
+    if (this.analogStreamPins.length === 0) {
+      this.ref();
+    }
+    this.analogStreamPins = pins;
+
+    this.command([
+      CMD.ADC_STREAM_START,
+      mask,
+      results.prescalarIndex,
+      results.period >> 8, results.period & 0xFF,
+    ], callback);
+  }
+
+  stopAnalogStream(callback) {
+    if (this.analogStreamPins.length !== 0) {
+      this.analogStreamPins = [];
+      this.unref();
+    }
+
+    this.command([CMD.ADC_STREAM_STOP], callback);
+  }
+
+  // Probe every I2C address from 0x08 to 0x77 in a single command and
+  // call back with the addresses that acknowledged. The bus is enabled
+  // at 100kHz if no I2C device has enabled it yet.
+  scanI2C(callback) {
+    if (!this.I2C.enabled) {
+      this.command([CMD.ENABLE_I2C, Tessel.I2C.computeBaud(1e5)]);
+      this.I2C.enabled = true;
+    }
+
+    this.request([CMD.I2C_SCAN], {
+      size: 16,
+      callback(error, bitmap) {
+        const addresses = [];
+        for (let address = 0; address < 128; address++) {
+          if (bitmap[address >> 3] & (1 << (address & 7))) {
+            addresses.push(address);
+          }
+        }
+        callback(error, addresses);
+      },
+    });
+  }
+
+  // Read all 8 pins with one command, calling back with a byte that has
+  // the level of pin n in bit n.
+  readAll(callback) {
+    this.request([CMD.GPIO_READ_ALL], {
+      size: 1,
+      callback(error, data) {
+        callback(error, data[0]);
+      },
+    });
+  }
+
+  // Set the pins whose bits are set in `mask` to the levels of the
+  // corresponding bits of `value`, at once for pins on the same bank of the
+  // SAMD21. The pins keep their direction; see setDirections.
+  writeMask(mask, value, callback) {
+    this.command([CMD.GPIO_WRITE_MASK, mask & 0xFF, value & 0xFF], callback);
+  }
+
+  // Make the pins whose bits are set in `mask` outputs where the bit of
+  // `outputs` is set and inputs where it is clear.
+  setDirections(mask, outputs, callback) {
+    this.command([CMD.GPIO_DIR_MASK, mask & 0xFF, outputs & 0xFF], callback);
+  }
+
+  // Have the coprocessor time pin interrupts to the microsecond, even
+  // while other commands are running, and send them in batches. Interrupt
+  // listeners are then passed the time of the edge in microseconds, which
+  // wraps around at 2^32, after the pin value for 'change'. Edges lost
+  // because the coprocessor's buffer was full are reported by
+  // 'pin-events-dropped' events with their count.
+  timestampPinEvents(enable, callback) {
+    this.command([CMD.GPIO_EVENTS, enable ? 1 : 0], callback);
+  }
+
+  // Count the `mode` edges ('rise', 'fall' or 'change') of `pin`, which
+  // must support interrupts, in the coprocessor's hardware. Edges are
+  // counted up to several MHz without being sent to the host. Counting
+  // uses the port's timer, so it stops a timed program, analog stream,
+  // waveform or pattern on the port.
+  startCounter(pin, mode, callback) {
+    if (INT_PINS.indexOf(pin) === -1) {
+      throw new RangeError(`Edges can only be counted on pins ${INT_PINS.join(', ')}`);
+    }
+
+    if (mode !== 'rise' && mode !== 'fall' && mode !== 'change') {
+      throw new RangeError(`Invalid counter mode "${mode}". Valid modes are "rise", "fall" and "change".`);
+    }
+
+    this.command([CMD.COUNTER_START, pin | (INT_MODES[mode] << 4)], callback);
+  }
+
+  stopCounter(callback) {
+    this.command([CMD.COUNTER_START, 0], callback);
+  }
+
+  // Call back with the edges counted since startCounter, which wrap around
+  // at 2^32, and the coprocessor's time of the read in microseconds. The
+  // frequency between two reads is the difference of their counts over
+  // the difference of their times.
+  readCounter(callback) {
+    this.request([CMD.COUNTER_READ], {
+      size: 8,
+      callback(error, data) {
+        if (error) {
+          callback(error);
+        } else {
+          callback(null, data.readUInt32BE(0), data.readUInt32BE(4));
+        }
+      },
+    });
+  }
+
+  // Decode a quadrature encoder on pins `a` and `b`, which must both
+  // support interrupts. The coprocessor counts the position on every edge,
+  // up with `b` leading `a`, so the host only reads it with readEncoder.
+  startEncoder(a, b, callback) {
+    if (INT_PINS.indexOf(a) === -1 || INT_PINS.indexOf(b) === -1 || a === b) {
+      throw new RangeError(`Encoders need two different pins of ${INT_PINS.join(', ')}`);
+    }
+
+    this.command([CMD.QUAD_START, a | (b << 3) | QUAD_ENABLE], callback);
+  }
+
+  stopEncoder(callback) {
+    this.command([CMD.QUAD_START, 0], callback);
+  }
+
+  // Call back with the encoder's position, a signed 32-bit count of its
+  // edges since startEncoder
+  readEncoder(callback) {
+    this.request([CMD.QUAD_READ], {
+      size: 4,
+      callback(error, data) {
+        if (error) {
+          callback(error);
+        } else {
+          callback(null, data.readInt32BE(0));
+        }
+      },
+    });
+  }
+
+  // Record the levels of all 8 pins `samples` times at `frequency` Hz
+  // with the coprocessor's DMA, like a logic analyzer, and call back with
+  // a Buffer of samples with pin n in bit n. The port's SPI, I2C and UART
+  // must be disabled, and its other commands wait for the capture. With
+  // `options.trigger` set to a pin that supports interrupts, sampling
+  // starts on its `options.mode` edge ('rise' by default) within
+  // `options.timeout` milliseconds (1000 by default).
+  capture(samples, frequency, options, callback) {
+    if (typeof options === 'function') {
+      callback = options;
+      options = {};
+    }
+    options = options || {};
+
+    if (!(samples >= 1 && samples <= CAPTURE_MAX_SAMPLES[this.name])) {
+      throw new RangeError(`Capture length must be within 1-${CAPTURE_MAX_SAMPLES[this.name]} samples on port ${this.name}`);
+    }
+
+    if (!(frequency > 0 && frequency <= CAPTURE_MAX_FREQUENCY)) {
+      throw new RangeError(`Capture frequency must be greater than 0 and at most ${CAPTURE_MAX_FREQUENCY}`);
+    }
+
+    let trigger = 0;
+    let timeout = 0;
+    if (options.trigger !== undefined) {
+      const pin = this.pin[options.trigger];
+      const mode = options.mode || 'rise';
+      if (!pin || !pin.supports.INT) {
+        throw new RangeError(`Captures can only be triggered by pins that support interrupts. Pins 2, 5, 6, and 7 on either port support interrupts.`);
+      }
+      if (typeof INT_MODES[mode] === 'undefined') {
+        throw new RangeError(`Invalid trigger mode "${mode}". Valid modes are "change", "rise", "fall", "high" and "low".`);
+      }
+      timeout = options.timeout === undefined ? 1000 : Math.round(options.timeout);
+      if (!(timeout >= 1 && timeout <= PULSE_TIMEOUT_MAX)) {
+        throw new RangeError(`Capture trigger timeout must be between 1 and ${PULSE_TIMEOUT_MAX} milliseconds`);
+      }
+      trigger = options.trigger | (INT_MODES[mode] << 4);
+    }
+
+    const results = determineDutyCycleAndPrescalar(frequency);
+
+    this.cork();
+    this.sock.write(new Buffer([CMD.CAPTURE_TRIGGER, trigger, timeout >> 8, timeout & 0xFF]));
+    this.request([
+      CMD.CAPTURE,
+      results.prescalarIndex,
+      results.period >> 8, results.period & 0xFF,
+      samples >> 8, samples & 0xFF,
+    ], {
+      size: samples,
+      callback(error, data) {
+        if (!error) {
+          callback(null, data);
+        } else if (data === REPLY.BUSY) {
+          callback(new Error('Cannot capture while the port\'s SPI, I2C or UART is enabled, or while the other port is capturing'));
+        } else {
+          callback(new Error('Timed out waiting for the capture trigger'));
+        }
+      },
+    });
+    this.uncork();
+  }
+
+  // Drive the pins whose bits are set in `options.mask` (all 8 by
+  // default) through `steps`, each a byte with the level of pin n in bit
+  // n, at `frequency` steps a second. The coprocessor's DMA writes the
+  // steps, so the timing doesn't depend on the host, but the port's SPI,
+  // I2C and UART must be disabled. The pins hold the last step and
+  // 'pattern-end' is emitted when done, unless `options.loop` repeats the
+  // pattern until stopPattern. Only one port plays a pattern at a time.
+  playPattern(steps, frequency, options, callback) {
+    if (typeof options === 'function') {
+      callback = options;
+      options = {};
+    }
+    options = options || {};
+
+    if (steps.length === 0 || steps.length > PATTERN_MAX_STEPS[this.name]) {
+      throw new RangeError(`Pattern length must be within 1-${PATTERN_MAX_STEPS[this.name]} steps on port ${this.name}`);
+    }
+
+    if (!(frequency > 0 && frequency <= PATTERN_MAX_FREQUENCY)) {
+      throw new RangeError(`Pattern frequency must be greater than 0 and at most ${PATTERN_MAX_FREQUENCY}`);
+    }
+
+    const mask = options.mask === undefined ? 0xFF : options.mask & 0xFF;
+    const results = determineDutyCycleAndPrescalar(frequency);
+
+    if (!this.patternPlaying) {
+      this.patternPlaying = true;
+      this.ref();
     }
 
+    this.cork();
+    this.sock.write(new Buffer([CMD.PATTERN_LOAD, mask, steps.length >> 8, steps.length & 0xFF]));
+    this.sock.write(new Buffer(steps));
+    this.sock.write(new Buffer([
+      CMD.PATTERN_PLAY,
+      results.prescalarIndex,
+      results.period >> 8, results.period & 0xFF,
+      options.loop ? 1 : 0,
+    ]));
     this.sync(callback);
     this.uncork();
   }
 
+  stopPattern(callback) {
+    if (this.patternPlaying) {
+      this.patternPlaying = false;
+      this.unref();
+    }
+
+    this.command([CMD.PATTERN_STOP], callback);
+  }
+
   rx(len, callback) {
-    if (len === 0 || len > 255) {
-      throw new RangeError('Buffer size must be within 1-255');
+    if (len === 0 || len > TRANSFER_MAX_LENGTH) {
+      throw new RangeError(`Buffer size must be within 1-${TRANSFER_MAX_LENGTH}`);
     }
 
-    this.sock.write(new Buffer([CMD.RX, len]));
+    this.sock.write(transferHeader(CMD.RX, len));
     this.enqueue({
       size: len,
       callback,
@@ -675,12 +1341,12 @@ class Port extends EventEmitter {
   txrx(buf, callback) {
     const len = buf.length;
 
-    if (len === 0 || len > 255) {
-      throw new RangeError('Buffer size must be within 1-255');
+    if (len === 0 || len > TRANSFER_MAX_LENGTH) {
+      throw new RangeError(`Buffer size must be within 1-${TRANSFER_MAX_LENGTH}`);
     }
 
     this.cork();
-    this.sock.write(new Buffer([CMD.TXRX, len]));
+    this.sock.write(transferHeader(CMD.TXRX, len));
     this.sock.write(buf);
     this.enqueue({
       size: len,
@@ -729,6 +1395,42 @@ function determineDutyCycleAndPrescalar(frequency) {
   };
 }
 
+/*
+ Returns the header of a TX, RX or TXRX command, using the command's
+ 16-bit length form when the length doesn't fit in a byte.
+*/
+function transferHeader(cmd, len) {
+  if (len <= 255) {
+    return new Buffer([cmd, len]);
+  }
+  const long = {
+    [CMD.TX]: CMD.TX_LONG,
+    [CMD.RX]: CMD.RX_LONG,
+    [CMD.TXRX]: CMD.TXRX_LONG,
+  };
+  return new Buffer([long[cmd], len >> 8, len & 0xFF]);
+}
+
+/*
+ Returns an Error for a status reply that reports a failed command,
+ or null for any other reply.
+*/
+function replyError(byte) {
+  switch (byte) {
+    case REPLY.NACK:
+      return new Error('I2C device did not acknowledge');
+    case REPLY.I2C_BUS_ERROR:
+      return new Error('I2C bus error');
+    case REPLY.I2C_ARB_LOST:
+      return new Error('I2C arbitration lost');
+    case REPLY.TIMEOUT:
+      return new Error('Timed out');
+    case REPLY.BUSY:
+      return new Error('Busy');
+  }
+  return null;
+}
+
 class Pin extends EventEmitter {
   constructor(pin, port) {
     super();
@@ -736,6 +1438,8 @@ class Pin extends EventEmitter {
     this.pin = pin;
     this.port = port;
     this.isPWM = false;
+    // True while a waveform started by playWaveform is playing
+    this.waveformPlaying = false;
     this.supports = {
       // These can be updated to use .includes()
       // once > Node 6 is supported.
@@ -852,13 +1556,10 @@ class Pin extends EventEmitter {
   }
 
   _readPin(cmd, callback) {
-    this.port.cork();
-    this.port.sock.write(new Buffer([cmd, this.pin]));
-    this.port.enqueue({
+    this.port.request([cmd, this.pin], {
       size: 0,
       callback: (error, data) => callback(error, data === REPLY.HIGH ? 1 : 0),
     });
-    this.port.uncork();
   }
 
   rawRead(callback) {
@@ -905,8 +1606,39 @@ class Pin extends EventEmitter {
     this.port.command([CMD.GPIO_PULL, (this.pin | (mode << 4))], callback);
   }
 
-  readPulse() {
-    throw new Error('Pin.readPulse is not yet implemented');
+  // Measure a 'high' or 'low' pulse, or the 'period' between two rising
+  // edges, and call back with its length in milliseconds (to the
+  // microsecond). The coprocessor times the edges, and the port's other
+  // commands wait until the pulse ends or `timeout` milliseconds pass.
+  readPulse(type, timeout, callback) {
+    if (!this.supports.INT) {
+      throw new RangeError(`Pulses can only be read on pins that support interrupts. Pins 2, 5, 6, and 7 on either port support interrupts.`);
+    }
+
+    if (typeof PULSE_MODES[type] === 'undefined') {
+      throw new RangeError(`Invalid pulse type "${type}". Valid types are "high", "low" and "period".`);
+    }
+
+    if (!(timeout >= 1 && timeout <= PULSE_TIMEOUT_MAX)) {
+      throw new RangeError(`Pulse timeout must be between 1 and ${PULSE_TIMEOUT_MAX} milliseconds`);
+    }
+
+    if (this.interruptMode) {
+      throw new Error(`Cannot read a pulse while listening for "${this.interruptMode}" interrupts`);
+    }
+
+    timeout = Math.round(timeout);
+
+    this.port.request([CMD.GPIO_PULSE, this.pin | (PULSE_MODES[type] << 4), timeout >> 8, timeout & 0xFF], {
+      size: 4,
+      callback(error, data) {
+        if (error) {
+          callback(new Error('Timed out waiting for a pulse'));
+        } else {
+          callback(null, data.readUInt32BE(0) / 1000);
+        }
+      },
+    });
   }
 
   analogRead(callback) {
@@ -918,8 +1650,7 @@ class Pin extends EventEmitter {
       throw new Error('analogPin.read is async, pass in a callback to get the value');
     }
 
-    this.port.sock.write(new Buffer([CMD.ANALOG_READ, this.pin]));
-    this.port.enqueue({
+    this.port.request([CMD.ANALOG_READ, this.pin], {
       size: 2,
       callback(err, data) {
         callback(err, (data[0] + (data[1] << 8)) / ANALOG_RESOLUTION);
@@ -940,10 +1671,78 @@ class Pin extends EventEmitter {
       throw new RangeError('Analog write must be between 0 and 1');
     }
 
+    if (this.waveformPlaying) {
+      this.waveformPlaying = false;
+      this.port.unref();
+    }
+
     this.port.sock.write(new Buffer([CMD.ANALOG_WRITE, data >> 8, data & 0xff]));
     return this;
   }
 
+  // Play `values` (each between 0 and 1) on the DAC, `frequency` values
+  // a second, paced by the coprocessor's timer. The output holds the
+  // last value and 'waveform-end' is emitted when done, unless
+  // `options.loop` repeats the waveform until stopWaveform.
+  playWaveform(values, frequency, options, callback) {
+    if (typeof options === 'function') {
+      callback = options;
+      options = {};
+    }
+    options = options || {};
+
+    if (this.port.name !== 'B' || this.pin !== 7) {
+      throw new RangeError('Waveforms can only be played on Pin 7 (G3) of Port B.');
+    }
+
+    if (values.length === 0 || values.length > WAVEFORM_MAX_LENGTH) {
+      throw new RangeError(`Waveform length must be within 1-${WAVEFORM_MAX_LENGTH}`);
+    }
+
+    if (!(frequency > 0)) {
+      throw new RangeError('Waveform frequency must be greater than 0');
+    }
+
+    // Samples are sent in the coprocessor's byte order
+    const table = new Buffer(values.length * 2);
+    values.forEach((val, i) => {
+      if (!(val >= 0 && val <= 1)) {
+        throw new RangeError('Waveform values must be between 0 and 1');
+      }
+      table.writeUInt16LE(Math.round(val * 0x3ff), i * 2);
+    });
+
+    const results = determineDutyCycleAndPrescalar(frequency);
+
+    if (!this.waveformPlaying) {
+      this.waveformPlaying = true;
+      this.port.ref();
+    }
+
+    this.port.cork();
+    this.port.sock.write(new Buffer([CMD.DAC_WAVE_LOAD, table.length >> 8, table.length & 0xFF]));
+    this.port.sock.write(table);
+    this.port.sock.write(new Buffer([
+      CMD.DAC_WAVE_PLAY,
+      results.prescalarIndex,
+      results.period >> 8, results.period & 0xFF,
+      options.loop ? 1 : 0,
+    ]));
+    this.port.sync(callback);
+    this.port.uncork();
+    return this;
+  }
+
+  stopWaveform(callback) {
+    if (this.waveformPlaying) {
+      this.waveformPlaying = false;
+      this.port.unref();
+    }
+
+    this.port.command([CMD.DAC_WAVE_STOP], callback);
+    return this;
+  }
+
   // Duty cycle should be a value between 0 and 1
   pwmDutyCycle(dutyCycle, callback) {
     // throw an error if this pin doesn't support PWM
@@ -1040,23 +1839,68 @@ class I2C {
     return Math.max(0, Math.min(baud, 255));
   }
 
+  // Request the outcome of the transaction just queued. A device that
+  // doesn't acknowledge, or a bus error, fails the transaction with an
+  // error instead of disabling the port.
+  status(callback) {
+    this.port.request([CMD.I2C_STATUS], {
+      size: 0,
+      callback,
+    });
+  }
+
   send(data, callback) {
     this.port.cork();
     this.port.command([CMD.START, this.address << 1]);
     this.port.tx(data);
-    this.port.command([CMD.STOP], callback);
+    this.port.command([CMD.STOP]);
+    if (callback) {
+      this.status(error => callback(error));
+    }
     this.port.uncork();
   }
 
   read(length, callback) {
+    let data;
+
     this.port.cork();
     this.port.command([CMD.START, this.address << 1 | 1]);
-    this.port.rx(length, callback);
+    this.port.rx(length, (error, rxdata) => {
+      data = rxdata;
+    });
     this.port.command([CMD.STOP]);
+    this.status(error => {
+      /* istanbul ignore else */
+      if (callback) {
+        callback(error, error ? undefined : data);
+      }
+    });
     this.port.uncork();
   }
 
+  // Write the register number, then read `length` bytes from it after
+  // a repeated start. This is a single command on the coprocessor.
+  readRegister(register, length, callback) {
+    if (length === 0 || length > 255) {
+      throw new RangeError('Buffer size must be within 1-255');
+    }
+
+    this.port.request([CMD.I2C_READ_REG, length, this.address << 1, register], {
+      size: length,
+      callback,
+    });
+  }
+
   transfer(txbuf, rxlen, callback) {
+    // Writing a register number and reading it back has its own command,
+    // which reads up to 255 bytes
+    if (txbuf.length === 1 && rxlen <= 255) {
+      this.readRegister(txbuf[0], rxlen, callback);
+      return;
+    }
+
+    let data;
+
     this.port.cork();
     /* istanbul ignore else */
     if (txbuf.length > 0) {
@@ -1064,8 +1908,16 @@ class I2C {
       this.port.tx(txbuf);
     }
     this.port.command([CMD.START, this.address << 1 | 1]);
-    this.port.rx(rxlen, callback);
+    this.port.rx(rxlen, (error, rxdata) => {
+      data = rxdata;
+    });
     this.port.command([CMD.STOP]);
+    this.status(error => {
+      /* istanbul ignore else */
+      if (callback) {
+        callback(error, error ? undefined : data);
+      }
+    });
     this.port.uncork();
   }
 }
@@ -1080,12 +1932,20 @@ class SPI {
     this.chipSelect = params.chipSelect || this.port.digital[0];
     this.chipSelectActive = params.chipSelectActive === 'high' || params.chipSelectActive === 1 ? 1 : 0;
 
-    if (this.chipSelectActive) {
-      // active high, pull low for now
-      this.chipSelect.low();
+    // A pin of this port is asserted by the coprocessor itself around each
+    // transfer; any other chip select is toggled with separate commands.
+    if (this.chipSelect instanceof Pin && this.chipSelect.port === this.port) {
+      this._chipSelectConfig = this.chipSelect.pin | SPI_CS_ENABLE | (this.chipSelectActive ? SPI_CS_ACTIVE_HIGH : 0);
     } else {
-      // active low, pull high for now
-      this.chipSelect.high();
+      this._chipSelectConfig = null;
+
+      if (this.chipSelectActive) {
+        // active high, pull low for now
+        this.chipSelect.low();
+      } else {
+        // active low, pull high for now
+        this.chipSelect.high();
+      }
     }
 
     /* spi baud rate is set by the following equation:
@@ -1133,13 +1993,50 @@ class SPI {
     this.cpha = params.cpha === 'second' || params.cpha === 1 ? 1 : 0;
 
     this.port.command([CMD.ENABLE_SPI, this.cpol + (this.cpha << 1), this._clockReg, this._clockDiv]);
+
+    if (this._chipSelectConfig !== null) {
+      // Also drives the chip select to its idle level
+      this.port.command([CMD.SPI_CS, this._chipSelectConfig]);
+    }
   }
 
   send(data, callback) {
     this.port.cork();
-    this.chipSelect.low();
-    this.port.tx(data, callback);
-    this.chipSelect.high();
+    if (this._chipSelectConfig === null) {
+      this.chipSelect.low();
+      this.port.tx(data, callback);
+      this.chipSelect.high();
+    } else if (data.length > TRANSFER_MAX_LENGTH) {
+      // Port#tx splits the data into several commands; keep the chip select
+      // asserted from the first to the last
+      this.port.command([CMD.SPI_CS, this._chipSelectConfig | SPI_CS_HOLD]);
+      this.port.tx(data, callback);
+      this.port.command([CMD.SPI_CS, this._chipSelectConfig]);
+    } else {
+      this.port.tx(data, callback);
+    }
+    this.port.uncork();
+  }
+
+  // Send a frame of color bytes to a chain of WS2812 LEDs on MOSI, in the
+  // order the LEDs take them (green, red, blue). The coprocessor expands
+  // each bit into the 3 bit SPI pattern the LEDs expect, so the clock must
+  // be 2.4MHz.
+  sendLEDs(data, callback) {
+    const speed = 48e6 / (2 * (this._clockReg + 1) * this._clockDiv);
+
+    if (Math.abs(speed - LED_STRIP_CLOCK) > LED_STRIP_CLOCK * 0.1) {
+      throw new RangeError(`LED strips need an SPI clock of ${LED_STRIP_CLOCK}Hz`);
+    }
+
+    if (data.length === 0 || data.length > LED_STRIP_MAX_LENGTH) {
+      throw new RangeError(`LED strip data must be within 1-${LED_STRIP_MAX_LENGTH} bytes`);
+    }
+
+    this.port.cork();
+    this.port.sock.write(new Buffer([CMD.LED_STRIP, data.length >> 8, data.length & 0xFF]));
+    this.port.sock.write(new Buffer(data));
+    this.port.sync(callback);
     this.port.uncork();
   }
 
@@ -1152,6 +2049,10 @@ class SPI {
   }
 
   receive(length, callback) {
+    if (this._chipSelectConfig !== null) {
+      this.port.rx(length, callback);
+      return;
+    }
     this.port.cork();
     this.chipSelect.low();
     this.port.rx(length, callback);
@@ -1160,6 +2061,10 @@ class SPI {
   }
 
   transfer(data, callback) {
+    if (this._chipSelectConfig !== null) {
+      this.port.txrx(data, callback);
+      return;
+    }
     this.port.cork();
     this.chipSelect.low();
     this.port.txrx(data, callback);
@@ -1184,9 +2089,11 @@ class UART extends Duplex {
           // baud = 65536*(1-(samples_per_bit)*(f_wanted/f_ref))
           // samples_per_bit = 16, 8, or 3
           // f_ref = 48e6
+          // With 16 samples per bit the SERCOM reaches f_ref/16 = 3MHz, and
+          // the coprocessor receives by DMA, so that is the ceiling.
 
-          if (value < 9600 || value > 230400) {
-            throw new Error('UART baudrate must be between 9600 and 230400');
+          if (value < 9600 || value > 3e6) {
+            throw new Error('UART baudrate must be between 9600 and 3000000');
           }
 
           baudrate = value;
@@ -1200,6 +2107,32 @@ class UART extends Duplex {
 
     this.port = port;
     this.baudrate = options.baudrate || 9600;
+
+    // Optional flow control on spare pins of the port, given as pin numbers
+    // or Pins: the coprocessor drives `rts` high while its receive buffer is
+    // filling up, and pauses transmission while `cts` is high. `cts` must be
+    // a pin that supports interrupts.
+    if (options.rts !== undefined || options.cts !== undefined) {
+      let flow = 0;
+
+      if (options.rts !== undefined) {
+        const rts = typeof options.rts === 'object' ? options.rts.pin : options.rts;
+        if (!(rts >= 0 && rts < 8) || UART_PINS.indexOf(rts) !== -1) {
+          throw new RangeError(`RTS can't be pin ${rts}`);
+        }
+        flow |= rts | UART_RTS;
+      }
+
+      if (options.cts !== undefined) {
+        const cts = typeof options.cts === 'object' ? options.cts.pin : options.cts;
+        if (INT_PINS.indexOf(cts) === -1 || UART_PINS.indexOf(cts) !== -1) {
+          throw new RangeError(`CTS can't be pin ${cts}`);
+        }
+        flow |= (cts << 3) | UART_CTS;
+      }
+
+      this.port.command([CMD.UART_FLOW, flow]);
+    }
   }
 
   _write(chunk, encoding, callback) {
@@ -1215,6 +2148,21 @@ class UART extends Duplex {
 
   _read() {}
 
+  // Call back with the number of received bytes lost since the last call:
+  // `dropped` were overwritten before the host read them, and `overflows`
+  // counts overruns of the SERCOM's own buffer.
+  status(callback) {
+    this.port.request([CMD.UART_STATUS], {
+      size: 4,
+      callback(error, data) {
+        callback(error, {
+          dropped: data.readUInt16BE(0),
+          overflows: data.readUInt16BE(2),
+        });
+      },
+    });
+  }
+
   disable() {
     // Tell the coprocessor to disable this interface
     this.port.command([CMD.DISABLE_UART, 0, 0]);
@@ -610,7 +610,7 @@ exports['Tessel.Port'] = {
   },
 
   instanceProperties(test) {
-    test.expect(16);
+    test.expect(19);
 
     const port = new Tessel.Port('foo', '/foo/bar/baz', this.tessel);
 
@@ -619,6 +619,9 @@ exports['Tessel.Port'] = {
     test.equal(port.name, 'foo');
     test.ok(Array.isArray(port.replyQueue));
     test.equal(port.replyQueue.length, 0);
+    test.equal(port.tagged, false);
+    test.ok(port.tags instanceof Map);
+    test.equal(port.tags.size, 0);
     test.ok(Array.isArray(port.pin));
     test.equal(port.pin.length, 8);
     test.ok(Array.isArray(port.pwm));
@@ -1115,7 +1118,7 @@ exports['Tessel.Port.prototype'] = {
   },
 
   txGreaterThanByteTransferLimit(test) {
-    test.expect(8);
+    test.expect(6);
 
     const buffer = new Buffer(510);
 
@@ -1128,15 +1131,35 @@ exports['Tessel.Port.prototype'] = {
     test.equal(this.cork.callCount, 1);
     test.equal(this.sync.callCount, 1);
     test.equal(this.uncork.callCount, 1);
+    test.equal(this.a.sock.write.callCount, 2);
+
+    // A single command with a 16-bit length
+    test.ok(this.a.sock.write.firstCall.args[0].equals(new Buffer([CMD.TX_LONG, 1, 254])));
+    test.ok(this.a.sock.write.lastCall.args[0].equals(buffer));
+
+    test.done();
+  },
+
+  txGreaterThanTransferLimit(test) {
+    test.expect(5);
+
+    const buffer = new Buffer(0x10000);
+
+    this.cork = sandbox.stub(Tessel.Port.prototype, 'cork');
+    this.sync = sandbox.stub(Tessel.Port.prototype, 'sync');
+    this.uncork = sandbox.stub(Tessel.Port.prototype, 'uncork');
+
+    this.a.tx(buffer, () => {});
+
     // The 2 call write sequence is called twice, since there
-    // is twice as many bytes as the transfer limit
+    // is one more byte than the transfer limit
     test.equal(this.a.sock.write.callCount, 4);
 
-    test.ok(this.a.sock.write.firstCall.args[0].equals(new Buffer([CMD.TX, 255])));
-    test.ok(this.a.sock.write.secondCall.args[0].equals(buffer.slice(0, 255)));
+    test.ok(this.a.sock.write.firstCall.args[0].equals(new Buffer([CMD.TX_LONG, 0xFF, 0xFF])));
+    test.ok(this.a.sock.write.secondCall.args[0].equals(buffer.slice(0, 0xFFFF)));
 
-    test.ok(this.a.sock.write.thirdCall.args[0].equals(new Buffer([CMD.TX, 255])));
-    test.ok(this.a.sock.write.lastCall.args[0].equals(buffer.slice(255)));
+    test.ok(this.a.sock.write.thirdCall.args[0].equals(new Buffer([CMD.TX, 1])));
+    test.ok(this.a.sock.write.lastCall.args[0].equals(buffer.slice(0xFFFF)));
 
     test.done();
   },
@@ -1151,6 +1174,115 @@ exports['Tessel.Port.prototype'] = {
     test.done();
   },
 
+  loadProgram(test) {
+    test.expect(6);
+
+    const program = new Buffer([CMD.GPIO_IN, 2, CMD.ANALOG_READ, 7]);
+
+    this.sync = sandbox.stub(Tessel.Port.prototype, 'sync');
+
+    this.a.loadProgram(program, () => {});
+
+    test.equal(this.sync.callCount, 1);
+    test.equal(this.a.sock.write.callCount, 2);
+    test.ok(this.a.sock.write.firstCall.args[0].equals(new Buffer([CMD.PROG_LOAD, program.length])));
+    test.ok(this.a.sock.write.lastCall.args[0].equals(program));
+
+    test.throws(() => {
+      this.a.loadProgram(new Buffer(0));
+    }, RangeError);
+    test.throws(() => {
+      this.a.loadProgram(new Buffer(256));
+    }, RangeError);
+
+    test.done();
+  },
+
+  runProgram(test) {
+    test.expect(7);
+
+    this.ref = sandbox.spy(this.a, 'ref');
+    this.unref = sandbox.spy(this.a, 'unref');
+    this.command = sandbox.stub(Tessel.Port.prototype, 'command');
+
+    // 10ms: 48MHz / 8 prescalar / 100Hz = 60000 ticks
+    this.a.runProgram({
+      interval: 10,
+      count: 300,
+      batch: 4,
+    });
+
+    test.equal(this.command.callCount, 1);
+    test.deepEqual(this.command.lastCall.args[0], [CMD.PROG_RUN, 3, 0xEA, 0x60, 0x01, 0x2C, 4]);
+    test.equal(this.a.programRunning, true);
+    test.equal(this.ref.callCount, 1);
+
+    this.a.stopProgram();
+
+    test.deepEqual(this.command.lastCall.args[0], [CMD.PROG_STOP]);
+    test.equal(this.unref.callCount, 1);
+
+    test.throws(() => {
+      this.a.runProgram({
+        interval: 0,
+      });
+    }, RangeError);
+
+    test.done();
+  },
+
+  triggerProgram(test) {
+    test.expect(6);
+
+    this.ref = sandbox.spy(this.a, 'ref');
+    this.command = sandbox.stub(Tessel.Port.prototype, 'command');
+
+    this.a.triggerProgram(5, 'fall', {
+      count: 0,
+      batch: 8,
+    });
+
+    test.equal(this.command.callCount, 1);
+    test.deepEqual(this.command.lastCall.args[0], [CMD.PROG_TRIGGER, 5 | (2 << 4), 0, 0, 8]);
+    test.equal(this.a.programRunning, true);
+    test.equal(this.ref.callCount, 1);
+
+    test.throws(() => {
+      this.a.triggerProgram(3, 'fall', {});
+    }, RangeError);
+    test.throws(() => {
+      this.a.triggerProgram(5, 'sideways', {});
+    }, RangeError);
+
+    test.done();
+  },
+
+  startAnalogStream(test) {
+    test.expect(6);
+
+    this.ref = sandbox.spy(this.b, 'ref');
+    this.unref = sandbox.spy(this.b, 'unref');
+    this.command = sandbox.stub(Tessel.Port.prototype, 'command');
+
+    // 2 pins at 1kHz: 48MHz / 1 prescalar / 2kHz = 24000 ticks
+    this.b.startAnalogStream([7, 2], 1000);
+
+    test.deepEqual(this.command.lastCall.args[0], [CMD.ADC_STREAM_START, (1 << 2) | (1 << 7), 0, 0x5D, 0xC0]);
+    test.deepEqual(this.b.analogStreamPins, [2, 7]);
+    test.equal(this.ref.callCount, 1);
+
+    this.b.stopAnalogStream();
+
+    test.deepEqual(this.command.lastCall.args[0], [CMD.ADC_STREAM_STOP]);
+    test.equal(this.unref.callCount, 1);
+
+    test.throws(() => {
+      this.a.startAnalogStream([0], 1000);
+    }, RangeError);
+
+    test.done();
+  },
+
   rx(test) {
     test.expect(5);
 
@@ -1190,11 +1322,199 @@ exports['Tessel.Port.prototype'] = {
     test.done();
   },
 
+  readAll(test) {
+    test.expect(4);
+
+    const callback = sandbox.spy();
+
+    this.a.readAll(callback);
+
+    test.ok(this.a.sock.write.lastCall.args[0].equals(new Buffer([CMD.GPIO_READ_ALL])));
+    test.equal(this.a.replyQueue.length, 1);
+    test.equal(this.a.replyQueue[0].size, 1);
+
+    this.a.replyQueue[0].callback(null, new Buffer([0xA5]));
+    test.deepEqual(callback.lastCall.args, [null, 0xA5]);
+
+    test.done();
+  },
+
+  capture(test) {
+    test.expect(5);
+
+    const callback = sandbox.spy();
+
+    this.b.capture(4096, 1e6, callback);
+
+    const writes = this.b.sock.write.callCount;
+    test.ok(this.b.sock.write.getCall(writes - 2).args[0].equals(new Buffer([CMD.CAPTURE_TRIGGER, 0, 0, 0])));
+    test.ok(this.b.sock.write.lastCall.args[0].equals(new Buffer([CMD.CAPTURE, 0, 0, 48, 0x10, 0x00])));
+    test.equal(this.b.replyQueue[0].size, 4096);
+
+    const samples = new Buffer(4096);
+    this.b.replyQueue[0].callback(null, samples);
+    test.equal(callback.lastCall.args[1], samples);
+
+    this.b.replyQueue[0].callback(new Error('Busy'), REPLY.BUSY);
+    test.ok(callback.lastCall.args[0] instanceof Error);
+
+    test.done();
+  },
+
+  captureTrigger(test) {
+    test.expect(3);
+
+    const callback = sandbox.spy();
+
+    this.a.capture(100, 1e6, {
+      trigger: 2,
+      mode: 'fall',
+      timeout: 500
+    }, callback);
+
+    const writes = this.a.sock.write.callCount;
+    test.ok(this.a.sock.write.getCall(writes - 2).args[0].equals(new Buffer([CMD.CAPTURE_TRIGGER, 2 | (2 << 4), 0x01, 0xF4])));
+
+    this.a.replyQueue[0].callback(new Error('Timed out'), REPLY.TIMEOUT);
+    test.equal(callback.lastCall.args[0].message, 'Timed out waiting for the capture trigger');
+
+    test.throws(() => this.a.capture(100, 1e6, {
+      trigger: 4
+    }, callback), RangeError);
+
+    test.done();
+  },
+
+  captureInvalid(test) {
+    test.expect(4);
+
+    test.throws(() => this.a.capture(0, 1e6), RangeError);
+    test.throws(() => this.a.capture(1639, 1e6), RangeError);
+    test.throws(() => this.b.capture(4097, 1e6), RangeError);
+    test.throws(() => this.b.capture(100, 5e6), RangeError);
+
+    test.done();
+  },
+
+  playPattern(test) {
+    test.expect(8);
+
+    this.sync = sandbox.stub(Tessel.Port.prototype, 'sync');
+    this.command = sandbox.stub(Tessel.Port.prototype, 'command');
+    this.ref = sandbox.spy(this.b, 'ref');
+    this.unref = sandbox.spy(this.b, 'unref');
+
+    // 1kHz: 48MHz / 1 prescalar / 1kHz = 48000 ticks
+    this.b.playPattern([0x01, 0x03, 0x02], 1000, {
+      mask: 0x03,
+      loop: true
+    });
+
+    const writes = this.b.sock.write.callCount;
+    test.ok(this.b.sock.write.getCall(writes - 3).args[0].equals(new Buffer([CMD.PATTERN_LOAD, 0x03, 0, 3])));
+    test.ok(this.b.sock.write.getCall(writes - 2).args[0].equals(new Buffer([0x01, 0x03, 0x02])));
+    test.ok(this.b.sock.write.lastCall.args[0].equals(new Buffer([CMD.PATTERN_PLAY, 0, 0xBB, 0x80, 1])));
+    test.equal(this.sync.callCount, 1);
+    test.equal(this.ref.callCount, 1);
+
+    this.b.stopPattern();
+
+    test.deepEqual(this.command.lastCall.args[0], [CMD.PATTERN_STOP]);
+    test.equal(this.unref.callCount, 1);
+    test.equal(this.b.patternPlaying, false);
+
+    test.done();
+  },
+
+  playPatternInvalid(test) {
+    test.expect(4);
+
+    test.throws(() => this.a.playPattern([], 1000), RangeError);
+    test.throws(() => this.a.playPattern(new Array(410).fill(0), 1000), RangeError);
+    test.throws(() => this.b.playPattern(new Array(1025).fill(0), 1000), RangeError);
+    test.throws(() => this.b.playPattern([0], 0), RangeError);
+
+    test.done();
+  },
+
+  counter(test) {
+    test.expect(6);
+
+    this.command = sandbox.stub(Tessel.Port.prototype, 'command');
+
+    this.a.startCounter(5, 'change');
+    test.deepEqual(this.command.lastCall.args[0], [CMD.COUNTER_START, 5 | (3 << 4)]);
+
+    this.a.stopCounter();
+    test.deepEqual(this.command.lastCall.args[0], [CMD.COUNTER_START, 0]);
+
+    test.throws(() => this.a.startCounter(4, 'rise'), RangeError);
+    test.throws(() => this.a.startCounter(5, 'high'), RangeError);
+
+    this.a.readCounter((error, count, time) => {
+      test.equal(count, 0x12345678);
+      test.equal(time, 1000000);
+    });
+    this.a.replyQueue[0].callback(null, new Buffer([0x12, 0x34, 0x56, 0x78, 0x00, 0x0F, 0x42, 0x40]));
+
+    test.done();
+  },
+
+  encoder(test) {
+    test.expect(5);
+
+    this.command = sandbox.stub(Tessel.Port.prototype, 'command');
+
+    this.b.startEncoder(5, 6);
+    test.deepEqual(this.command.lastCall.args[0], [CMD.QUAD_START, 5 | (6 << 3) | 0x80]);
+
+    this.b.stopEncoder();
+    test.deepEqual(this.command.lastCall.args[0], [CMD.QUAD_START, 0]);
+
+    test.throws(() => this.b.startEncoder(5, 5), RangeError);
+    test.throws(() => this.b.startEncoder(3, 5), RangeError);
+
+    this.b.readEncoder((error, position) => {
+      test.equal(position, -2);
+    });
+    this.b.replyQueue[0].callback(null, new Buffer([0xFF, 0xFF, 0xFF, 0xFE]));
+
+    test.done();
+  },
+
+  writeMaskAndDirections(test) {
+    test.expect(2);
+
+    this.command = sandbox.stub(Tessel.Port.prototype, 'command');
+
+    this.a.setDirections(0x0F, 0x0F);
+    test.deepEqual(this.command.lastCall.args[0], [CMD.GPIO_DIR_MASK, 0x0F, 0x0F]);
+
+    this.a.writeMask(0x0F, 0x05);
+    test.deepEqual(this.command.lastCall.args[0], [CMD.GPIO_WRITE_MASK, 0x0F, 0x05]);
+
+    test.done();
+  },
+
+  rxLong(test) {
+    test.expect(3);
+
+    const size = 1024;
+
+    this.a.rx(size, () => {});
+
+    test.equal(this.a.sock.write.callCount, 1);
+    test.ok(this.a.sock.write.lastCall.args[0].equals(new Buffer([CMD.RX_LONG, 4, 0])));
+    test.equal(this.a.replyQueue[0].size, size);
+
+    test.done();
+  },
+
   rxInvalidLengthMax(test) {
     test.expect(1);
 
     test.throws(() => {
-      this.a.rx(256);
+      this.a.rx(0x10000);
     }, RangeError);
 
     test.done();
@@ -1240,10 +1560,28 @@ exports['Tessel.Port.prototype'] = {
     test.done();
   },
 
+  txrxLong(test) {
+    test.expect(4);
+
+    this.cork = sandbox.stub(Tessel.Port.prototype, 'cork');
+    this.uncork = sandbox.stub(Tessel.Port.prototype, 'uncork');
+
+    const buffer = new Buffer(256);
+
+    this.a.txrx(buffer, () => {});
+
+    test.equal(this.a.sock.write.callCount, 2);
+    test.ok(this.a.sock.write.firstCall.args[0].equals(new Buffer([CMD.TXRX_LONG, 1, 0])));
+    test.ok(this.a.sock.write.lastCall.args[0].equals(buffer));
+    test.equal(this.a.replyQueue[0].size, buffer.length);
+
+    test.done();
+  },
+
   txrxInvalidLengthMax(test) {
     test.expect(1);
 
-    const buffer = new Buffer(256);
+    const buffer = new Buffer(0x10000);
 
     test.throws(() => {
       this.a.txrx(buffer);
@@ -1391,6 +1729,160 @@ exports['Tessel.Port Commands (handling incoming socket stream)'] = {
     test.done();
   },
 
+  replyTaggedOutOfOrder(test) {
+    test.expect(6);
+
+    const first = sandbox.spy();
+    const second = sandbox.spy();
+
+    this.port.tags.set(1, {
+      size: 0,
+      callback: first,
+    });
+    this.port.tags.set(2, {
+      size: 2,
+      callback: second,
+    });
+
+    // The second command completes first, then the first is acknowledged
+    this.port.sock.read.returns(new Buffer([REPLY.TAGGED, 2, REPLY.DATA, 0xff, 0x7f, REPLY.TAGGED, 1, REPLY.ACK]));
+    this.port.sock.emit('readable');
+
+    test.equal(second.callCount, 1);
+    test.ok(second.lastCall.args[1].equals(new Buffer([0xff, 0x7f])));
+    test.equal(first.callCount, 1);
+    test.equal(first.lastCall.args[1], REPLY.ACK);
+    test.ok(second.calledBefore(first));
+    test.equal(this.port.tags.size, 0);
+    test.done();
+  },
+
+  replyTaggedPartial(test) {
+    test.expect(2);
+
+    this.port.tags.set(7, {
+      size: 2,
+      callback(err, data) {
+        test.ok(data.equals(new Buffer([0x3f, 0x1f])));
+        test.equal(this.replyQueue.length, 1);
+        test.done();
+      },
+    });
+
+    // An untagged command is still waiting for its reply
+    this.port.replyQueue.push({
+      size: 0,
+      callback() {},
+    });
+
+    this.port.sock.read.returns(new Buffer([REPLY.TAGGED, 7]));
+    this.port.sock.emit('readable');
+
+    this.port.sock.read.returns(new Buffer([REPLY.DATA, 0x3f]));
+    this.port.sock.emit('readable');
+
+    this.port.sock.read.returns(new Buffer([0x1f]));
+    this.port.sock.emit('readable');
+  },
+
+  replyProgramData(test) {
+    test.expect(4);
+
+    const data = sandbox.spy();
+    const end = sandbox.spy();
+
+    this.port.on('program-data', data);
+    this.port.on('program-end', end);
+    this.port.programRunning = true;
+
+    this.port.sock.read.returns(new Buffer([REPLY.ASYNC_PROG_DATA, 0, 4, REPLY.HIGH, REPLY.DATA]));
+    this.port.sock.emit('readable');
+
+    test.equal(data.callCount, 0);
+
+    this.port.sock.read.returns(new Buffer([0xff, 0x0f, REPLY.ASYNC_PROG_END]));
+    this.port.sock.emit('readable');
+
+    test.equal(data.callCount, 1);
+    test.ok(data.lastCall.args[0].equals(new Buffer([REPLY.HIGH, REPLY.DATA, 0xff, 0x0f])));
+    test.equal(end.callCount, 1);
+    test.done();
+  },
+
+  replyAnalogStreamData(test) {
+    test.expect(3);
+
+    const data = sandbox.spy();
+    const overrun = sandbox.spy();
+
+    this.port.on('analog-data', data);
+    this.port.on('analog-overrun', overrun);
+    this.port.analogStreamPins = [2, 7];
+
+    this.port.sock.read.returns(new Buffer([
+      REPLY.ASYNC_ADC_OVERRUN,
+      REPLY.ASYNC_ADC_DATA, 0, 8,
+      0x00, 0x00, 0x00, 0x10,
+      0x00, 0x08, 0x00, 0x04,
+    ]));
+    this.port.sock.emit('readable');
+
+    test.equal(overrun.callCount, 1);
+    test.equal(data.callCount, 1);
+    test.deepEqual(data.lastCall.args[0], [
+      [0, 1],
+      [0.5, 0.25],
+    ]);
+    test.done();
+  },
+
+  replyWaveformEnd(test) {
+    test.expect(3);
+
+    const end = sandbox.spy();
+    this.unref = sandbox.spy(this.port, 'unref');
+
+    this.port.pin[7].on('waveform-end', end);
+    this.port.pin[7].waveformPlaying = true;
+
+    this.port.sock.read.returns(new Buffer([REPLY.ASYNC_DAC_WAVE_END]));
+    this.port.sock.emit('readable');
+
+    test.equal(end.callCount, 1);
+    test.equal(this.port.pin[7].waveformPlaying, false);
+    test.equal(this.unref.callCount, 1);
+    test.done();
+  },
+
+  replyPatternEnd(test) {
+    test.expect(3);
+
+    const end = sandbox.spy();
+    this.unref = sandbox.spy(this.port, 'unref');
+
+    this.port.on('pattern-end', end);
+    this.port.patternPlaying = true;
+
+    this.port.sock.read.returns(new Buffer([REPLY.ASYNC_PATTERN_END]));
+    this.port.sock.emit('readable');
+
+    test.equal(end.callCount, 1);
+    test.equal(this.port.patternPlaying, false);
+    test.equal(this.unref.callCount, 1);
+    test.done();
+  },
+
+  replyTaggedUnknown(test) {
+    test.expect(1);
+
+    test.throws(() => {
+      this.port.sock.read.returns(new Buffer([REPLY.TAGGED, 3, REPLY.ACK]));
+      this.port.sock.emit('readable');
+    }, Error);
+
+    test.done();
+  },
+
 
   replyasyncpinchange(test) {
     test.expect(4);
@@ -1880,6 +2372,43 @@ exports['Tessel.Pin'] = {
     test.done();
   },
 
+  interruptTimestamped(test) {
+    test.expect(6);
+
+    const change = sandbox.spy();
+    const rise = sandbox.spy();
+    const dropped = sandbox.spy();
+
+    this.a.timestampPinEvents(true);
+    test.deepEqual(this.command.lastCall.args[0], [CMD.GPIO_EVENTS, 1]);
+
+    this.a.pin[2].on('change', change);
+    this.a.pin[5].on('rise', rise);
+    this.a.on('pin-events-dropped', dropped);
+
+    // A batch of two events, with 3 dropped, split across two reads
+    const batch = new Buffer([
+      REPLY.ASYNC_PIN_EVENTS, 2, 0, 3,
+      2 | (1 << 3), 0x00, 0x00, 0x03, 0xE8,
+      5 | (1 << 3), 0x00, 0x00, 0x05, 0xDC,
+    ]);
+    this.a.sock.read.returns(batch.slice(0, 8));
+    this.a.sock.emit('readable');
+    test.equal(change.callCount, 0);
+
+    this.a.sock.read.returns(batch.slice(8));
+    this.a.sock.emit('readable');
+
+    test.deepEqual(change.lastCall.args, [1, 1000]);
+    test.deepEqual(rise.lastCall.args, [1500]);
+    test.deepEqual(dropped.lastCall.args, [3]);
+
+    this.a.timestampPinEvents(false);
+    test.deepEqual(this.command.lastCall.args[0], [CMD.GPIO_EVENTS, 0]);
+
+    test.done();
+  },
+
   removeListener(test) {
     test.expect(14);
 
@@ -2095,6 +2624,56 @@ exports['Tessel.Pin'] = {
     test.done();
   },
 
+  playWaveform(test) {
+    test.expect(7);
+
+    this.sync = sandbox.stub(Tessel.Port.prototype, 'sync');
+    this.ref = sandbox.spy(this.b, 'ref');
+    this.unref = sandbox.spy(this.b, 'unref');
+
+    // 1kHz: 48MHz / 1 prescalar / 1kHz = 48000 ticks
+    this.b.pin[7].playWaveform([0, 0.5, 1], 1000, { loop: true });
+
+    test.equal(this.b.sock.write.callCount, 3);
+    test.ok(this.b.sock.write.firstCall.args[0].equals(new Buffer([CMD.DAC_WAVE_LOAD, 0, 6])));
+    test.ok(this.b.sock.write.secondCall.args[0].equals(new Buffer([0x00, 0x00, 0x00, 0x02, 0xFF, 0x03])));
+    test.ok(this.b.sock.write.lastCall.args[0].equals(new Buffer([CMD.DAC_WAVE_PLAY, 0, 0xBB, 0x80, 1])));
+    test.equal(this.ref.callCount, 1);
+
+    this.b.pin[7].stopWaveform();
+
+    test.deepEqual(this.command.lastCall.args[0], [CMD.DAC_WAVE_STOP]);
+    test.equal(this.unref.callCount, 1);
+
+    test.done();
+  },
+
+  playWaveformRangeError(test) {
+    test.expect(5);
+
+    test.throws(() => {
+      this.a.pin[7].playWaveform([0], 1000);
+    }, RangeError);
+
+    test.throws(() => {
+      this.b.pin[7].playWaveform([], 1000);
+    }, RangeError);
+
+    test.throws(() => {
+      this.b.pin[7].playWaveform(new Array(257).fill(0), 1000);
+    }, RangeError);
+
+    test.throws(() => {
+      this.b.pin[7].playWaveform([1.1], 1000);
+    }, RangeError);
+
+    test.throws(() => {
+      this.b.pin[7].playWaveform([0], 0);
+    }, RangeError);
+
+    test.done();
+  },
+
   analogReadPortAndPinRangeWarning(test) {
     test.expect(16);
 
@@ -2270,6 +2849,27 @@ exports['Tessel.Pin'] = {
     queued(null, REPLY.LOW);
   },
 
+  _readPinTagged(test) {
+    test.expect(5);
+    const pin = 2;
+
+    this.a.tagged = true;
+    sandbox.stub(this.a, 'enqueue');
+
+    this.a.pin[pin]._readPin(CMD.GPIO_IN, (error, data) => {
+      test.equal(data, 1);
+      test.equal(this.a.tags.size, 0);
+      test.done();
+    });
+
+    test.equal(this.a.enqueue.callCount, 0);
+    test.ok(this.a.sock.write.firstCall.args[0].equals(new Buffer([CMD.TAG, 0])));
+    test.ok(this.a.sock.write.lastCall.args[0].equals(new Buffer([CMD.GPIO_IN, pin])));
+
+    this.a.sock.read.returns(new Buffer([REPLY.TAGGED, 0, REPLY.HIGH]));
+    this.a.sock.emit('readable');
+  },
+
   rawRead(test) {
     test.expect(2);
 
@@ -2355,6 +2955,48 @@ exports['Tessel.Pin'] = {
     test.done();
   },
 
+  readPulseInvalid(test) {
+    test.expect(4);
+
+    test.throws(() => this.a.pin[2].readPulse('sideways', 100, () => {}), RangeError);
+    test.throws(() => this.a.pin[2].readPulse('high', 0, () => {}), RangeError);
+    test.throws(() => this.a.pin[2].readPulse('high', 0x10000, () => {}), RangeError);
+
+    this.a.pin[2].on('change', () => {});
+    test.throws(() => this.a.pin[2].readPulse('high', 100, () => {}));
+
+    test.done();
+  },
+
+  readPulseHigh(test) {
+    test.expect(3);
+
+    this.a.pin[5].readPulse('high', 1000, (error, length) => {
+      test.equal(error, null);
+      test.equal(length, 1.5);
+      test.done();
+    });
+
+    test.ok(this.a.sock.write.lastCall.args[0].equals(new Buffer([CMD.GPIO_PULSE, 5, 0x03, 0xE8])));
+
+    this.a.sock.read.returns(new Buffer([REPLY.DATA, 0x00, 0x00, 0x05, 0xDC]));
+    this.a.sock.emit('readable');
+  },
+
+  readPulseTimeout(test) {
+    test.expect(2);
+
+    this.b.pin[7].readPulse('period', 20, (error) => {
+      test.equal(error.message, 'Timed out waiting for a pulse');
+      test.done();
+    });
+
+    test.ok(this.b.sock.write.lastCall.args[0].equals(new Buffer([CMD.GPIO_PULSE, 7 | (2 << 4), 0, 20])));
+
+    this.b.sock.read.returns(new Buffer([REPLY.TIMEOUT]));
+    this.b.sock.emit('readable');
+  },
+
 
 };
 
@@ -2541,13 +3183,13 @@ exports['Tessel.I2C'] = {
 
     device.read(4, handler);
 
-    test.equal(device.port.cork.callCount, 1);
+    test.equal(device.port.cork.callCount, 2);
     test.equal(device.port.command.callCount, 2);
     test.equal(device.port.rx.callCount, 1);
-    test.equal(device.port.uncork.callCount, 1);
+    test.equal(device.port.uncork.callCount, 2);
 
     test.deepEqual(device.port.rx.firstCall.args[0], 4);
-    test.equal(device.port.rx.firstCall.args[1], handler);
+    test.ok(this.socket.write.lastCall.args[0].equals(new Buffer([CMD.I2C_STATUS])));
 
     // See:
     // Tessel.I2C.prototype.read
@@ -2574,10 +3216,10 @@ exports['Tessel.I2C'] = {
 
     device.send([0, 1, 2, 3], () => {});
 
-    test.equal(device.port.cork.callCount, 1);
+    test.equal(device.port.cork.callCount, 2);
     test.equal(device.port.command.callCount, 2);
     test.equal(device.port.tx.callCount, 1);
-    test.equal(device.port.uncork.callCount, 1);
+    test.equal(device.port.uncork.callCount, 2);
 
     test.deepEqual(device.port.tx.firstCall.args[0], [0, 1, 2, 3]);
 
@@ -2608,15 +3250,15 @@ exports['Tessel.I2C'] = {
 
     device.transfer([0, 1, 2, 3], 4, handler);
 
-    test.equal(device.port.cork.callCount, 1);
+    test.equal(device.port.cork.callCount, 2);
     test.equal(device.port.command.callCount, 3);
     test.equal(device.port.tx.callCount, 1);
     test.equal(device.port.rx.callCount, 1);
-    test.equal(device.port.uncork.callCount, 1);
+    test.equal(device.port.uncork.callCount, 2);
 
     test.deepEqual(device.port.tx.firstCall.args[0], [0, 1, 2, 3]);
     test.deepEqual(device.port.rx.firstCall.args[0], 4);
-    test.equal(device.port.rx.firstCall.args[1], handler);
+    test.ok(this.socket.write.lastCall.args[0].equals(new Buffer([CMD.I2C_STATUS])));
 
     // See:
     // Tessel.I2C.prototype.transfer
@@ -2629,6 +3271,111 @@ exports['Tessel.I2C'] = {
     test.done();
   },
 
+  readRegister(test) {
+    test.expect(7);
+
+    const device = new Tessel.I2C({
+      address: 0x01,
+      port: this.port
+    });
+
+    const handler = () => {};
+
+    device.readRegister(0x0F, 2, handler);
+
+    test.ok(this.socket.write.lastCall.args[0].equals(new Buffer([CMD.I2C_READ_REG, 2, device.addr << 1, 0x0F])));
+    test.deepEqual(device.port.replyQueue, [{
+      size: 2,
+      callback: handler,
+    }]);
+
+    test.throws(() => {
+      device.readRegister(0x0F, 0, handler);
+    }, RangeError);
+
+    // A one byte transfer is a register read
+    device.transfer([0x10], 4, handler);
+
+    test.ok(this.socket.write.lastCall.args[0].equals(new Buffer([CMD.I2C_READ_REG, 4, device.addr << 1, 0x10])));
+    test.equal(device.port.rx.callCount, 0);
+
+    // Longer reads than the register read allows use a repeated start
+    device.transfer([0x10], 256, handler);
+
+    test.equal(device.port.rx.callCount, 1);
+    test.equal(device.port.rx.lastCall.args[0], 256);
+
+    test.done();
+  },
+
+  statusNack(test) {
+    test.expect(3);
+
+    const device = new Tessel.I2C({
+      address: 0x01,
+      port: this.port
+    });
+
+    this.rx.restore();
+    this.socket.read = sandbox.stub();
+
+    device.read(2, (error, data) => {
+      test.ok(error instanceof Error);
+      test.equal(data, undefined);
+    });
+    device.send([0], error => {
+      test.equal(error, null);
+    });
+
+    // The failed read's data is zero-filled and followed by its status
+    this.socket.read.returns(new Buffer([REPLY.DATA, 0, 0, REPLY.NACK, REPLY.ACK]));
+    this.socket.emit('readable');
+
+    test.done();
+  },
+
+  readRegisterNack(test) {
+    test.expect(1);
+
+    const device = new Tessel.I2C({
+      address: 0x01,
+      port: this.port
+    });
+
+    this.socket.read = sandbox.stub();
+
+    device.readRegister(0x0F, 2, error => {
+      test.ok(error instanceof Error);
+    });
+
+    // A failed register read replies with its status in place of the data
+    this.socket.read.returns(new Buffer([REPLY.I2C_BUS_ERROR]));
+    this.socket.emit('readable');
+
+    test.done();
+  },
+
+  scanI2C(test) {
+    test.expect(2);
+
+    this.socket.read = sandbox.stub();
+
+    this.port.scanI2C((error, addresses) => {
+      test.deepEqual(addresses, [0x08, 0x3C, 0x77]);
+    });
+
+    test.ok(this.socket.write.lastCall.args[0].equals(new Buffer([CMD.I2C_SCAN])));
+
+    const bitmap = new Buffer(16).fill(0);
+    bitmap[1] = 0x01;
+    bitmap[7] = 0x10;
+    bitmap[14] = 0x80;
+    this.socket.read.returns(Buffer.concat([new Buffer([REPLY.DATA]), bitmap]));
+    this.socket.emit('readable');
+
+    test.done();
+  },
+
 };
 
 exports['Tessel.I2C.computeBaud'] = {
@@ -2760,12 +3507,78 @@ exports['Tessel.UART'] = {
       baudrate: b1
     });
 
-    test.throws(() => uart.baudrate = 230401);
+    test.throws(() => uart.baudrate = 3e6 + 1);
     test.equal(uart.baudrate, b1);
 
     test.done();
   },
 
+  flowControl(test) {
+    test.expect(2);
+
+    new this.port.UART({
+      rts: 2,
+      cts: this.port.pin[7],
+    });
+
+    test.equal(this.command.callCount, 2);
+    // RTS pin 2, CTS pin 7, both enabled
+    test.deepEqual(this.command.lastCall.args[0], [CMD.UART_FLOW, 2 | (7 << 3) | 0xC0]);
+
+    test.done();
+  },
+
+  flowControlInvalidPins(test) {
+    test.expect(3);
+
+    test.throws(() => new this.port.UART({
+      rts: 5
+    }), RangeError);
+
+    test.throws(() => new this.port.UART({
+      cts: 3
+    }), RangeError);
+
+    test.throws(() => new this.port.UART({
+      cts: 6
+    }), RangeError);
+
+    test.done();
+  },
+
+  baudrateMax(test) {
+    test.expect(2);
+
+    const uart = new this.port.UART({
+      baudrate: 3e6
+    });
+
+    test.equal(uart.baudrate, 3e6);
+    test.deepEqual(this.command.lastCall.args[0], [14, 0, 0]);
+
+    test.done();
+  },
+
+  status(test) {
+    test.expect(3);
+
+    const uart = new this.port.UART();
+    const request = sandbox.stub(this.port, 'request');
+
+    uart.status((error, counts) => {
+      test.equal(error, null);
+      test.deepEqual(counts, {
+        dropped: 0x102,
+        overflows: 3,
+      });
+    });
+
+    test.deepEqual(request.lastCall.args[0], [CMD.UART_STATUS]);
+    request.lastCall.args[1].callback(null, new Buffer([1, 2, 0, 3]));
+
+    test.done();
+  },
+
   interfaceChange(test) {
     test.expect(3);
 
@@ -3261,6 +4074,78 @@ exports['Tessel.SPI'] = {
 
     test.done();
   },
+
+  managedChipSelect(test) {
+    test.expect(8);
+
+    const spi = new this.port.SPI({
+      chipSelectActive: 'high'
+    });
+
+    // Pin 5 | enable | active high
+    test.deepEqual(this.command.lastCall.args[0], [42, 0x8D]);
+
+    this.command.reset();
+
+    spi.send(new Buffer([0xFF]));
+    spi.receive(4);
+    spi.transfer(new Buffer([0xFF]));
+
+    test.equal(this.tx.callCount, 1);
+    test.equal(this.rx.callCount, 1);
+    test.equal(this.txrx.callCount, 1);
+    test.equal(this.command.callCount, 0);
+
+    // Chunked sends hold the chip select across every chunk
+    spi.send(new Buffer(0x10000));
+
+    test.equal(this.command.callCount, 2);
+    test.deepEqual(this.command.firstCall.args[0], [42, 0xCD]);
+    test.deepEqual(this.command.lastCall.args[0], [42, 0x8D]);
+
+    test.done();
+  },
+
+  sendLEDs(test) {
+    test.expect(6);
+
+    const spi = new this.port.SPI({
+      clockSpeed: 2.4e6
+    });
+
+    this.cork.reset();
+    this.uncork.reset();
+    this.socket.write.reset();
+
+    const data = new Buffer([0x00, 0xFF, 0x10, 0x20, 0x30, 0x40]);
+
+    spi.sendLEDs(data, () => {});
+
+    test.equal(this.cork.callCount, 1);
+    test.equal(this.uncork.callCount, 1);
+    test.equal(this.socket.write.callCount, 3);
+    test.deepEqual(this.socket.write.firstCall.args[0], new Buffer([Tessel.CMD.LED_STRIP, 0x00, 0x06]));
+    test.deepEqual(this.socket.write.secondCall.args[0], data);
+    test.deepEqual(this.socket.write.lastCall.args[0], new Buffer([Tessel.CMD.ECHO, 1, 0x88]));
+
+    test.done();
+  },
+
+  sendLEDsInvalid(test) {
+    test.expect(3);
+
+    const spi = new this.port.SPI();
+
+    // The default 2MHz clock doesn't meet the LEDs' timing
+    test.throws(() => spi.sendLEDs(new Buffer(3)), RangeError);
+
+    spi._clockReg = 9;
+
+    test.throws(() => spi.sendLEDs(new Buffer(0)), RangeError);
+    test.throws(() => spi.sendLEDs(new Buffer(1537)), RangeError);
+
+    test.done();
+  },
 };
 
 exports['Tessel.Wifi'] = {
@@ -15,10 +15,49 @@
 #include <sys/ioctl.h>
 #include <linux/types.h>
 #include <linux/spi/spidev.h>
+#include <linux/version.h>
 #include <syslog.h>
+#include <signal.h>
+#include <time.h>
+#include <dirent.h>
+
+// The GPIO character device ABI (line handles and line events) appeared in Linux 4.8
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(4, 8, 0)
+#include <linux/gpio.h>
+#define HAVE_GPIO_CHARDEV 1
+#endif
 
 #define N_CHANNEL 3
-#define BUFSIZE 255
+#define BUFSIZE 1024
+// Largest frame that fits in the 8-bit length field of a v1 header
+#define BUFSIZE_V1 255
+
+// Header command bytes sent by us and replied by the coprocessor, per header version
+#define CMD_V1 0x53
+#define REPLY_V1 0xCA
+#define CMD_V2 0x54
+#define REPLY_V2 0xCB
+
+// Status bit advertising support for the v2 header (16-bit little-endian lengths)
+#define STATUS_V2 0x08
+
+// v1 header: cmd, status, 8-bit size per channel
+#define CTRL_SIZE_V1 (2 + N_CHANNEL)
+// v2 header: cmd, status, caps, reserved byte, 16-bit size per channel
+#define CTRL_SIZE_V2 (4 + 2 * N_CHANNEL)
+
+// v2 caps bits. A mode is used once both sides advertise it.
+// Pipelined transactions: one SYNC edge and one SPI message per cycle, carrying the data phase
+// for the previously exchanged headers followed by the headers for the next cycle.
+#define CAP_PIPELINE 0x01
+// Full-duplex data phase: a channel's OUT and IN payloads share the same clock cycles. Applies to
+// a data phase when both of its headers have the bit set. Only advertised when enabled with -f,
+// as it requires an SPI controller that can transmit and receive at the same time.
+#define CAP_FULL_DUPLEX 0x02
+
+// Header status byte: writable (or ready) bits per channel, and opened (or enabled) bits
+#define WRITABLE_MASK ((1 << N_CHANNEL) - 1)
+#define OPENED_MASK (WRITABLE_MASK << 4)
 
 #define STATUS_TRUE 1
 #define STATUS_FALSE 0
@@ -39,11 +78,34 @@ typedef struct ChannelData {
     int in_length;
     char out_buf[BUFSIZE];
     int out_length;
+    // Bytes of out_buf already sent to the coprocessor
+    int out_offset;
+    // Bytes of out_buf advertised in the current header, starting at out_pending_offset
+    int out_pending;
+    int out_pending_offset;
     char in_buf[BUFSIZE];
 } ChannelData;
 
 ChannelData channels[N_CHANNEL];
 
+// Header version used for the next transaction. Starts at v1 and switches to v2 once the
+// coprocessor has advertised STATUS_V2 in a valid reply.
+int bridge_version = 1;
+
+// Whether to advertise CAP_FULL_DUPLEX (-f)
+bool full_duplex = false;
+
+// Set once both sides advertised CAP_PIPELINE in a v2 header
+bool pipelined = false;
+// In pipelined mode, whether headers were exchanged at the end of the last transaction
+bool have_next_header = false;
+// In pipelined mode, the headers exchanged at the end of the last transaction
+uint8_t next_tx_buf[CTRL_SIZE_V2];
+uint8_t next_rx_buf[CTRL_SIZE_V2];
+int next_in_size[N_CHANNEL];
+// In pipelined mode, the opened bits sent in the last header whose data phase has run
+uint8_t processed_opened;
+
 uint8_t channels_writable_bitmask;
 uint8_t channels_opened_bitmask;
 uint8_t channels_enabled_bitmask;
@@ -97,6 +159,266 @@ void gpio_edge(const char* gpio, const char* mode) {
     close(fd);
 }
 
+/// Use sysfs to unexport the specified GPIO, if it is exported
+void gpio_unexport(const char* gpio) {
+    char path[512];
+    snprintf(path, sizeof(path), "/sys/class/gpio/gpio%s", gpio);
+    if (access(path, F_OK) != 0) {
+        return;
+    }
+
+    int fd = open("/sys/class/gpio/unexport", O_WRONLY);
+    if (fd < 0) {
+        return;
+    }
+    if (write(fd, gpio, strlen(gpio)) < 0) {
+        error("GPIO unexport write: %s", strerror(errno));
+    }
+    close(fd);
+}
+
+// Whether IRQ and SYNC use the GPIO character device rather than sysfs
+bool gpio_chardev = false;
+
+// Set by -s to always use sysfs
+bool force_sysfs = false;
+
+/*
+Reads a sysfs attribute, stripping the trailing newline
+
+Args:
+    path: Path of the attribute
+    buf: Buffer to fill
+    len: Size of buf
+
+Returns:
+    true if the attribute was read
+*/
+bool read_sysfs_attr(const char* path, char* buf, size_t len) {
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) {
+        return false;
+    }
+    int r = read(fd, buf, len - 1);
+    close(fd);
+    if (r <= 0) {
+        return false;
+    }
+    buf[r] = 0;
+    char* nl = strchr(buf, '\n');
+    if (nl) {
+        *nl = 0;
+    }
+    return true;
+}
+
+#ifdef HAVE_GPIO_CHARDEV
+
+/*
+Finds the character device and line offset for a GPIO argument
+
+Args:
+    gpio: Either "gpiochipN:offset", or a global sysfs GPIO number, which is resolved through the
+          base, ngpio and label attributes of /sys/class/gpio/gpiochip*
+    chip_path: Filled with the path of the chip's character device
+    len: Size of chip_path
+    offset: Filled with the line offset within the chip
+
+Returns:
+    true if the line was found
+*/
+bool gpio_chardev_lookup(const char* gpio, char* chip_path, size_t len, uint32_t* offset) {
+    const char* sep = strchr(gpio, ':');
+    if (sep) {
+        snprintf(chip_path, len, "/dev/%.*s", (int)(sep - gpio), gpio);
+        *offset = strtoul(sep + 1, NULL, 10);
+        return true;
+    }
+
+    unsigned num = strtoul(gpio, NULL, 10);
+    char label[64] = "";
+
+    DIR* dir = opendir("/sys/class/gpio");
+    if (!dir) {
+        return false;
+    }
+    struct dirent* ent;
+    while ((ent = readdir(dir)) != NULL) {
+        if (strncmp(ent->d_name, "gpiochip", 8) != 0) {
+            continue;
+        }
+
+        char path[512];
+        char buf[64];
+        snprintf(path, sizeof(path), "/sys/class/gpio/%s/base", ent->d_name);
+        if (!read_sysfs_attr(path, buf, sizeof(buf))) continue;
+        unsigned base = strtoul(buf, NULL, 10);
+        snprintf(path, sizeof(path), "/sys/class/gpio/%s/ngpio", ent->d_name);
+        if (!read_sysfs_attr(path, buf, sizeof(buf))) continue;
+        unsigned ngpio = strtoul(buf, NULL, 10);
+
+        if (num >= base && num < base + ngpio) {
+            snprintf(path, sizeof(path), "/sys/class/gpio/%s/label", ent->d_name);
+            if (read_sysfs_attr(path, label, sizeof(label))) {
+                *offset = num - base;
+            }
+            break;
+        }
+    }
+    closedir(dir);
+
+    if (label[0] == 0) {
+        return false;
+    }
+
+    // Match the sysfs chip to its character device by label
+    bool found = false;
+    dir = opendir("/dev");
+    if (!dir) {
+        return false;
+    }
+    while (!found && (ent = readdir(dir)) != NULL) {
+        if (strncmp(ent->d_name, "gpiochip", 8) != 0) {
+            continue;
+        }
+
+        snprintf(chip_path, len, "/dev/%s", ent->d_name);
+        int fd = open(chip_path, O_RDONLY);
+        if (fd < 0) {
+            continue;
+        }
+        struct gpiochip_info info;
+        if (ioctl(fd, GPIO_GET_CHIPINFO_IOCTL, &info) == 0 && strcmp(info.label, label) == 0) {
+            found = true;
+        }
+        close(fd);
+    }
+    closedir(dir);
+
+    return found;
+}
+
+/*
+Requests a GPIO line from its character device, as an output handle or an event source
+
+Args:
+    gpio: GPIO argument, see gpio_chardev_lookup
+    event: true to request rising edge events, false to request an output driven high
+
+Returns:
+    The line handle or event file descriptor, or -1 if the line could not be requested
+*/
+int gpio_chardev_request(const char* gpio, bool event) {
+    char chip_path[256];
+    uint32_t offset;
+    if (!gpio_chardev_lookup(gpio, chip_path, sizeof(chip_path), &offset)) {
+        return -1;
+    }
+
+    int chip_fd = open(chip_path, O_RDONLY);
+    if (chip_fd < 0) {
+        error("Error opening %s: %s\n", chip_path, strerror(errno));
+        return -1;
+    }
+
+    int fd = -1;
+    for (int attempt = 0; attempt < 2 && fd < 0; attempt++) {
+        int r;
+        if (event) {
+            struct gpioevent_request req;
+            memset(&req, 0, sizeof(req));
+            req.lineoffset = offset;
+            req.handleflags = GPIOHANDLE_REQUEST_INPUT;
+            req.eventflags = GPIOEVENT_REQUEST_RISING_EDGE;
+            strncpy(req.consumer_label, "spid irq", sizeof(req.consumer_label) - 1);
+            r = ioctl(chip_fd, GPIO_GET_LINEEVENT_IOCTL, &req);
+            fd = req.fd;
+        } else {
+            struct gpiohandle_request req;
+            memset(&req, 0, sizeof(req));
+            req.lineoffsets[0] = offset;
+            req.lines = 1;
+            req.flags = GPIOHANDLE_REQUEST_OUTPUT;
+            req.default_values[0] = 1;
+            strncpy(req.consumer_label, "spid sync", sizeof(req.consumer_label) - 1);
+            r = ioctl(chip_fd, GPIO_GET_LINEHANDLE_IOCTL, &req);
+            fd = req.fd;
+        }
+
+        if (r < 0) {
+            fd = -1;
+            // A line left exported by a previous sysfs run is busy until it's unexported
+            if (errno == EBUSY && attempt == 0 && !strchr(gpio, ':')) {
+                gpio_unexport(gpio);
+                continue;
+            }
+            error("Error requesting %s line %u: %s\n", chip_path, offset, strerror(errno));
+        }
+    }
+
+    close(chip_fd);
+
+    if (fd >= 0 && event) {
+        // Events are drained without blocking
+        fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+    }
+
+    return fd;
+}
+
+#endif
+
+// Edge to SYNC latency accounting, logged on SIGUSR1
+volatile sig_atomic_t dump_stats = 0;
+// Kernel timestamp of the last unhandled IRQ edge, in ns, or 0
+uint64_t irq_timestamp = 0;
+uint64_t irq_count = 0;
+uint64_t irq_latency_total = 0;
+uint64_t irq_latency_max = 0;
+uint64_t transaction_count = 0;
+
+void handle_sigusr1(int sig) {
+    dump_stats = 1;
+}
+
+/// Read a clock in ns
+uint64_t clock_ns(clockid_t clock) {
+    struct timespec ts;
+    clock_gettime(clock, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+/// Record the latency from the last IRQ edge to the start of the transaction that serves it
+void record_irq_latency() {
+    if (irq_timestamp == 0) {
+        return;
+    }
+
+    // Line events are stamped with CLOCK_MONOTONIC since Linux 5.7, and CLOCK_REALTIME before
+    uint64_t now = clock_ns(CLOCK_MONOTONIC);
+    if (irq_timestamp > now || now - irq_timestamp > 10000000000ull) {
+        now = clock_ns(CLOCK_REALTIME);
+    }
+
+    if (now >= irq_timestamp) {
+        uint64_t latency = now - irq_timestamp;
+        irq_count++;
+        irq_latency_total += latency;
+        if (latency > irq_latency_max) {
+            irq_latency_max = latency;
+        }
+    }
+    irq_timestamp = 0;
+}
+
+void log_stats() {
+    info("%llu transactions, %llu IRQ edges, IRQ to SYNC latency avg %llu us, max %llu us\n",
+        (unsigned long long) transaction_count,
+        (unsigned long long) irq_count,
+        (unsigned long long) (irq_count ? irq_latency_total / irq_count / 1000 : 0),
+        (unsigned long long) (irq_latency_max / 1000));
+}
+
 // IRQ pin pollfd (when coprocessor has async data)
 #define GPIO_POLL fds[0]
 // connected domain socket pollfds
@@ -107,10 +429,61 @@ void gpio_edge(const char* gpio, const char* mode) {
 struct pollfd fds[N_POLLFDS];
 int usbd_sock_fd;
 struct sockaddr_un usbd_sock_addr;
+int sync_fd;
+int sync_level;
 void delay() {
     usleep(10);
 }
 
+/// Drive the SYNC pin
+void sync_write(int level) {
+#ifdef HAVE_GPIO_CHARDEV
+    if (gpio_chardev) {
+        struct gpiohandle_data data;
+        memset(&data, 0, sizeof(data));
+        data.values[0] = level;
+        if (ioctl(sync_fd, GPIOHANDLE_SET_LINE_VALUES_IOCTL, &data) < 0) {
+            fatal("GPIO set line values: %s", strerror(errno));
+        }
+        sync_level = level;
+        return;
+    }
+#endif
+
+    if (write(sync_fd, level ? "1" : "0", 1) < 0) {
+        fatal("GPIO write: %s", strerror(errno));
+    }
+    sync_level = level;
+}
+
+/// Acknowledge IRQ pin edges reported by poll
+void irq_ack(int irq_fd) {
+#ifdef HAVE_GPIO_CHARDEV
+    if (gpio_chardev) {
+        struct gpioevent_data event;
+        int r;
+        while ((r = read(irq_fd, &event, sizeof(event))) == sizeof(event)) {
+            debug("GPIO event %u at %llu\n", event.id, (unsigned long long) event.timestamp);
+            // Measure from the oldest edge not yet served by a transaction
+            if (irq_timestamp == 0) {
+                irq_timestamp = event.timestamp;
+            }
+        }
+        if (r < 0 && errno != EAGAIN) {
+            fatal("GPIO event read: %s", strerror(errno));
+        }
+        return;
+    }
+#endif
+
+    char buf[2];
+    lseek(irq_fd, SEEK_SET, 0);
+    if (read(irq_fd, buf, 2) < 0) {
+        fatal("GPIO read: %s", strerror(errno));
+    }
+    debug("GPIO interrupt %c\n", buf[0]);
+}
+
 /*
 Fetches the stored open/closed state of a given channel
 
@@ -173,8 +546,10 @@ void close_channel_connection(uint8_t channel) {
     close(CONN_POLL(channel).fd);
     // Reset the file descriptor
     CONN_POLL(channel).fd = -1;
-    // Clear the outgoing data
+    // Clear the outgoing data. A chunk already advertised to the coprocessor in a pipelined
+    // header is still sent from out_pending_offset.
     channels[channel].out_length = 0;
+    channels[channel].out_offset = 0;
     // Re-enable events on a new connection if it's still enabled
     if (get_channel_bitmask_state(&channels_enabled_bitmask, channel) && channel != USBD_CHANNEL) {
         SOCK_POLL(channel).events = POLLIN;
@@ -275,37 +650,397 @@ void manage_channel_active_status(uint8_t *rx_buf) {
     }
 }
 
+/*
+Builds the header we send to the coprocessor in the current header version
+
+Args:
+    tx_buf: Buffer of at least CTRL_SIZE_V2 bytes to fill
+    writable: Bitmask of channels able to accept data from the coprocessor
+
+Returns:
+    The size of the header
+*/
+int build_header(uint8_t *tx_buf, uint8_t writable) {
+    int limit = bridge_version >= 2 ? BUFSIZE : BUFSIZE_V1;
+    uint8_t status = writable | (channels_opened_bitmask << 4) | STATUS_V2;
+
+    for (int i=0; i<N_CHANNEL; i++) {
+        // Frames larger than the header can describe are sent over multiple transactions
+        int remaining = channels[i].out_length - channels[i].out_offset;
+        channels[i].out_pending = remaining < limit ? remaining : limit;
+        channels[i].out_pending_offset = channels[i].out_offset;
+    }
+
+    if (bridge_version >= 2) {
+        tx_buf[0] = CMD_V2;
+        tx_buf[1] = status;
+        tx_buf[2] = CAP_PIPELINE | (full_duplex ? CAP_FULL_DUPLEX : 0);
+        tx_buf[3] = 0;
+        for (int i=0; i<N_CHANNEL; i++) {
+            tx_buf[4 + i*2] = channels[i].out_pending & 0xFF;
+            tx_buf[5 + i*2] = channels[i].out_pending >> 8;
+        }
+        return CTRL_SIZE_V2;
+    } else {
+        tx_buf[0] = CMD_V1;
+        tx_buf[1] = status;
+        for (int i=0; i<N_CHANNEL; i++) {
+            tx_buf[2 + i] = channels[i].out_pending;
+        }
+        return CTRL_SIZE_V1;
+    }
+}
+
+/*
+Parses the header replied by the coprocessor and negotiates the header version
+
+Args:
+    rx_buf: Buffer received over SPI from the coprocessor
+    in_size: Filled with the number of bytes the coprocessor will send on each channel
+
+Returns:
+    true if the reply was valid for the current header version
+*/
+bool parse_header(uint8_t *rx_buf, int *in_size) {
+    if (bridge_version >= 2 && rx_buf[0] == REPLY_V2) {
+        for (int i=0; i<N_CHANNEL; i++) {
+            in_size[i] = rx_buf[4 + i*2] | (rx_buf[5 + i*2] << 8);
+            if (in_size[i] > BUFSIZE) {
+                bridge_version = 1;
+                pipelined = false;
+                return false;
+            }
+        }
+        if ((rx_buf[2] & CAP_PIPELINE) && !pipelined) {
+            // Takes effect after the data phase for this header
+            info("Coprocessor supports pipelined transactions, switching");
+            pipelined = true;
+            have_next_header = false;
+        }
+    } else if (bridge_version == 1 && rx_buf[0] == REPLY_V1) {
+        for (int i=0; i<N_CHANNEL; i++) {
+            in_size[i] = rx_buf[2 + i];
+        }
+        if (rx_buf[1] & STATUS_V2) {
+            info("Coprocessor supports 16-bit lengths, switching to v2 header");
+            bridge_version = 2;
+        }
+    } else {
+        // Fall back to v1 so that the coprocessor can renegotiate, e.g. after it was reset
+        bridge_version = 1;
+        pipelined = false;
+        return false;
+    }
+
+    return true;
+}
+
+/*
+Checks whether the data phase for a pair of exchanged headers is full duplex
+
+Args:
+    tx_buf: Header we sent
+    rx_buf: Valid header replied by the coprocessor
+*/
+bool is_full_duplex(uint8_t *tx_buf, uint8_t *rx_buf) {
+    return rx_buf[0] == REPLY_V2 && (tx_buf[2] & rx_buf[2] & CAP_FULL_DUPLEX);
+}
+
+/*
+Adds the data phase transfers for a pair of exchanged headers
+
+Args:
+    transfer: Array of transfers to fill
+    coproc_status: Status byte of the coprocessor's header
+    writable: Writable bitmask we sent in our header
+    in_size: Number of bytes the coprocessor will send on each channel
+    duplex: Whether OUT and IN payloads of a channel are clocked at the same time
+
+Returns:
+    The number of transfers added
+*/
+int prepare_data_transfer(struct spi_ioc_transfer *transfer, uint8_t coproc_status, uint8_t writable, int *in_size, bool duplex) {
+    int desc = 0;
+
+    for (int chan=0; chan<N_CHANNEL; chan++) {
+        int out_size = 0;
+        char *out_ptr = &channels[chan].out_buf[channels[chan].out_pending_offset];
+        // If the coprocessor is ready to receive, and we have data to send
+        if (coproc_status & (1<<chan) && channels[chan].out_pending > 0) {
+            out_size = channels[chan].out_pending;
+            debug("coprocessor is ready to receive and we have %d bytes from channel %d", out_size, chan);
+            channels[chan].out_pending = 0;
+            // Once the whole buffer is sent, make this channel readable again
+            if (channels[chan].out_length > 0) {
+                channels[chan].out_offset += out_size;
+                if (channels[chan].out_offset >= channels[chan].out_length) {
+                    CONN_POLL(chan).events |= POLLIN;
+                    channels[chan].out_length = 0;
+                    channels[chan].out_offset = 0;
+                }
+            }
+        }
+
+        int in_size_chan = 0;
+        char *in_ptr = &channels[chan].in_buf[0];
+        // Check that the channel was writable and there is data that needs to be received
+        if (writable & (1<<chan) && in_size[chan] > 0) {
+            in_size_chan = in_size[chan];
+            debug("Channel %d is ready to have %d bytes written to it from bridge", chan, in_size_chan);
+        }
+
+        if (duplex) {
+            // Clock both directions together, then whatever is left of the longer one
+            int both = out_size < in_size_chan ? out_size : in_size_chan;
+            if (both > 0) {
+                transfer[desc].len = both;
+                transfer[desc].tx_buf = (unsigned long) out_ptr;
+                transfer[desc].rx_buf = (unsigned long) in_ptr;
+                desc++;
+            }
+            if (out_size > both) {
+                transfer[desc].len = out_size - both;
+                transfer[desc].tx_buf = (unsigned long) (out_ptr + both);
+                desc++;
+            } else if (in_size_chan > both) {
+                transfer[desc].len = in_size_chan - both;
+                transfer[desc].rx_buf = (unsigned long) (in_ptr + both);
+                desc++;
+            }
+        } else {
+            if (out_size > 0) {
+                // Point the output buffer to the correct place
+                transfer[desc].len = out_size;
+                transfer[desc].tx_buf = (unsigned long) out_ptr;
+                desc++;
+            }
+            if (in_size_chan > 0) {
+                // Point our receive buffer to the in buf of the appropriate channel
+                transfer[desc].len = in_size_chan;
+                transfer[desc].rx_buf = (unsigned long) in_ptr;
+                desc++;
+            }
+        }
+    }
+
+    return desc;
+}
+
+/*
+Writes data received in a data phase to the appropriate sockets
+
+Args:
+    writable: Writable bitmask we sent in our header
+    in_size: Number of bytes the coprocessor sent on each channel
+*/
+void complete_data_transfer(uint8_t writable, int *in_size) {
+    for (int chan=0; chan<N_CHANNEL; chan++) {
+        // Get the length of the received data for this channel
+        int size = in_size[chan];
+        // Make sure that channel is still writable (it may have been closed since the header was
+        // sent) and we have data to send to it
+        if (writable & (1<<chan) && get_channel_bitmask_state(&channels_writable_bitmask, chan) && size > 0) {
+            // Write this data to the pipe
+            int r = write(CONN_POLL(chan).fd, &channels[chan].in_buf[0], size);
+            debug("%i: Write %u %i\n", chan, size, r);
+            // Ensure there were no errors
+            if (r < 0) {
+                error("Error in write %i: %s\n", chan, strerror(errno));
+            }
+
+            // Mark we want to know when this pipe is writable again
+            CONN_POLL(chan).events |= POLLOUT;
+            // Set the state to not writable
+            set_channel_bitmask_state(&channels_writable_bitmask, chan, false);
+        }
+    }
+}
+
+/*
+Checks whether the headers exchanged at the end of the last pipelined transaction require another
+transaction right away, rather than waiting for the IRQ pin or a socket event
+
+Returns:
+    true if the next data phase transfers data or processes an open/close
+*/
+bool pipelined_pending() {
+    if (!have_next_header) {
+        return false;
+    }
+
+    if ((next_tx_buf[1] & OPENED_MASK) != processed_opened) {
+        return true;
+    }
+
+    for (int chan=0; chan<N_CHANNEL; chan++) {
+        if (next_rx_buf[1] & (1<<chan) && channels[chan].out_pending > 0) {
+            return true;
+        }
+        if (next_tx_buf[1] & (1<<chan) && next_in_size[chan] > 0) {
+            return true;
+        }
+    }
+
+    return false;
+}
+
+/*
+Runs one pipelined transaction: a SYNC edge, then a single SPI message with the data phase for the
+headers exchanged at the end of the previous transaction, followed by the exchange of the headers
+for the next one
+
+Args:
+    spi_fd: The SPI device
+
+Returns:
+    false if the coprocessor replied with an invalid header
+*/
+bool pipelined_transfer(int spi_fd) {
+    struct spi_ioc_transfer transfer[N_CHANNEL * 2 + 2];
+    memset(transfer, 0, sizeof(transfer));
+    int desc = 0;
+
+    uint8_t writable = 0;
+    uint8_t receiving = 0;
+
+    if (have_next_header) {
+        writable = next_tx_buf[1] & WRITABLE_MASK;
+        desc = prepare_data_transfer(transfer, next_rx_buf[1], writable, next_in_size,
+            is_full_duplex(next_tx_buf, next_rx_buf));
+        processed_opened = next_tx_buf[1] & OPENED_MASK;
+
+        for (int chan=0; chan<N_CHANNEL; chan++) {
+            if (writable & (1<<chan) && next_in_size[chan] > 0) {
+                receiving |= (1<<chan);
+            }
+        }
+    }
+
+    // The next header is built after this data phase claimed its outgoing data. Channels
+    // receiving data now are only writable again once that data is written to the socket.
+    uint8_t tx_buf[CTRL_SIZE_V2];
+    uint8_t rx_buf[CTRL_SIZE_V2];
+    memset(rx_buf, 0, sizeof(rx_buf));
+    build_header(tx_buf, channels_writable_bitmask & ~receiving);
+
+    // Our header, then the coprocessor's
+    transfer[desc].len = CTRL_SIZE_V2;
+    transfer[desc].tx_buf = (unsigned long)tx_buf;
+    desc++;
+    transfer[desc].len = CTRL_SIZE_V2;
+    transfer[desc].rx_buf = (unsigned long)rx_buf;
+    desc++;
+
+    // Every SYNC edge starts a transaction
+    record_irq_latency();
+    transaction_count++;
+    sync_write(!sync_level);
+
+    delay();
+
+    int status = ioctl(spi_fd, SPI_IOC_MESSAGE(desc), transfer);
+    if (status < 0) {
+        fatal("SPI_IOC_MESSAGE: pipelined: %s", strerror(errno));
+    }
+
+    if (have_next_header) {
+        complete_data_transfer(writable, next_in_size);
+    }
+
+    memcpy(next_tx_buf, tx_buf, sizeof(next_tx_buf));
+    memcpy(next_rx_buf, rx_buf, sizeof(next_rx_buf));
+
+    have_next_header = parse_header(rx_buf, next_in_size);
+    if (!have_next_header) {
+        error("Invalid pipelined reply: %2x %2x %2x %2x %2x\n", rx_buf[0], rx_buf[1], rx_buf[2], rx_buf[3], rx_buf[4]);
+        return false;
+    }
+
+    // Check for any open/close requests on the channels
+    manage_channel_active_status(rx_buf);
+
+    return true;
+}
+
 int main(int argc, char** argv) {
     openlog("spid", LOG_PERROR | LOG_PID | LOG_NDELAY, LOG_LOCAL1);
     info("Starting");
 
+    int opt;
+    while ((opt = getopt(argc, argv, "fs")) != -1) {
+        switch (opt) {
+            case 'f':
+                full_duplex = true;
+                break;
+            case 's':
+                force_sysfs = true;
+                break;
+            default:
+                fatal("usage: spid [-f] [-s] /dev/spidev0.1 irq_gpio sync_gpio /var/run/tessel\n");
+        }
+    }
+    argc -= optind - 1;
+    argv += optind - 1;
+
     if (argc != 5) {
-      fatal("usage: spid /dev/spidev0.1 irq_gpio sync_gpio /var/run/tessel\n");
+      fatal("usage: spid [-f] [-s] /dev/spidev0.1 irq_gpio sync_gpio /var/run/tessel\n");
     }
 
+    struct sigaction sa;
+    memset(&sa, 0, sizeof(sa));
+    sa.sa_handler = handle_sigusr1;
+    sa.sa_flags = SA_RESTART;
+    sigaction(SIGUSR1, &sa, NULL);
+
     // Open SPI
     int spi_fd = open(argv[1], O_RDWR);
     if (spi_fd < 0) {
       fatal("Error opening SPI device %s: %s\n", argv[1], strerror(errno));
     }
 
-    // set up IRQ pin
-    gpio_export(argv[2]);
-    gpio_direction(argv[2], "in");
-    gpio_edge(argv[2], "rising");
-    int irq_fd = gpio_open(argv[2], "value");
+    int irq_fd = -1;
+    sync_level = 1;
+
+#ifdef HAVE_GPIO_CHARDEV
+    // Prefer the GPIO character device: one ioctl per SYNC change, and timestamped IRQ edges
+    if (!force_sysfs) {
+        irq_fd = gpio_chardev_request(argv[2], true);
+        sync_fd = gpio_chardev_request(argv[3], false);
+        if (irq_fd >= 0 && sync_fd >= 0) {
+            gpio_chardev = true;
+            info("Using GPIO character device");
+        } else {
+            if (irq_fd >= 0) close(irq_fd);
+            if (sync_fd >= 0) close(sync_fd);
+            info("GPIO character device unavailable, falling back to sysfs");
+        }
+    }
+#endif
+
+    if (!gpio_chardev) {
+        if (strchr(argv[2], ':') || strchr(argv[3], ':')) {
+            fatal("gpiochip:offset GPIOs require the GPIO character device\n");
+        }
 
-    // set up sync pin
-    gpio_export(argv[3]);
-    gpio_edge(argv[3], "none");
-    gpio_direction(argv[3], "high");
-    int sync_fd = gpio_open(argv[3], "value");
+        // set up IRQ pin
+        gpio_export(argv[2]);
+        gpio_direction(argv[2], "in");
+        gpio_edge(argv[2], "rising");
+        irq_fd = gpio_open(argv[2], "value");
+
+        // set up sync pin
+        gpio_export(argv[3]);
+        gpio_edge(argv[3], "none");
+        gpio_direction(argv[3], "high");
+        sync_fd = gpio_open(argv[3], "value");
+    }
 
     memset(channels, 0, sizeof(channels));
     memset(fds, 0, sizeof(fds));
 
     GPIO_POLL.fd = irq_fd;
-    GPIO_POLL.events = POLLPRI;
+    // sysfs signals edges with POLLPRI, line events with POLLIN
+    GPIO_POLL.events = gpio_chardev ? POLLIN : POLLPRI;
 
     // Create the listening unix domain sockets
     for (int i = 0; i<N_CHANNEL; i++) {
@@ -365,11 +1100,21 @@ int main(int argc, char** argv) {
             fds[i].revents = 0;
         }
 
-        int nfds = poll(fds, N_POLLFDS, 5000);
-        if (nfds < 0) {
+        // In pipelined mode, the last header exchange may already call for another transaction
+        int nfds = poll(fds, N_POLLFDS, pipelined_pending() ? 0 : 5000);
+        if (nfds < 0 && errno != EINTR) {
             fatal("Error in poll: %s", strerror(errno));
         }
 
+        if (dump_stats) {
+            dump_stats = 0;
+            log_stats();
+        }
+
+        if (nfds < 0) {
+            continue;
+        }
+
         debug("poll returned: %i\n", nfds);
 
         for (int i=0; i<N_POLLFDS; i++) {
@@ -383,21 +1128,25 @@ int main(int argc, char** argv) {
         debug("\n");
 
         // If it was a GPIO interrupt on the IRQ pin, acknowlege it
-        if (GPIO_POLL.revents & POLLPRI) {
-            char buf[2];
-            lseek(irq_fd, SEEK_SET, 0);
-            if (read(irq_fd, buf, 2) < 0) {
-                fatal("GPIO read: %s", strerror(errno));
-            }
-            debug("GPIO interrupt %c\n", buf[0]);
+        if (GPIO_POLL.revents & (POLLPRI | POLLIN)) {
+            irq_ack(irq_fd);
         }
 
-        // Sync pin low
-        if (write(sync_fd, "0", 1) < 0) {
-            fatal("GPIO write: %s", strerror(errno));
-        }
+        if (!pipelined) {
+            // SYNC is left low by an odd number of pipelined transactions; raise it so the
+            // falling edge below starts the control phase
+            if (sync_level == 0) {
+                sync_write(1);
+                delay();
+            }
 
-        delay();
+            // Sync pin low
+            record_irq_latency();
+            transaction_count++;
+            sync_write(0);
+
+            delay();
+        }
 
         // Check for new connections on unconnected sockets
         for (int i=0; i<N_CHANNEL; i++) {
@@ -461,25 +1210,31 @@ int main(int argc, char** argv) {
             }
         }
 
+        if (pipelined) {
+            if (pipelined_transfer(spi_fd)) {
+                retries = 0;
+            } else if (++retries > 15) {
+                fatal("Too many retries, exiting");
+            }
+            continue;
+        }
+
         // Prepare the header transfer
         struct spi_ioc_transfer ctrl_transfer[2];
         memset(ctrl_transfer, 0, sizeof(ctrl_transfer));
 
-        uint8_t tx_buf[2 + N_CHANNEL];
-        uint8_t rx_buf[2 + N_CHANNEL];
+        uint8_t tx_buf[CTRL_SIZE_V2];
+        uint8_t rx_buf[CTRL_SIZE_V2];
+        memset(rx_buf, 0, sizeof(rx_buf));
 
-        tx_buf[0] = 0x53;
-        tx_buf[1] = channels_writable_bitmask | (channels_opened_bitmask << 4);
-
-        for (int i=0; i<N_CHANNEL; i++) {
-            tx_buf[2+i] = channels[i].out_length;
-        }
+        uint8_t writable = channels_writable_bitmask;
+        int ctrl_size = build_header(tx_buf, writable);
 
         debug("tx: %2x %2x %2x %2x %2x\n", tx_buf[0], tx_buf[1], tx_buf[2], tx_buf[3], tx_buf[4]);
 
-        ctrl_transfer[0].len = sizeof(tx_buf);
+        ctrl_transfer[0].len = ctrl_size;
         ctrl_transfer[0].tx_buf = (unsigned long)tx_buf;
-        ctrl_transfer[1].len = sizeof(rx_buf);
+        ctrl_transfer[1].len = ctrl_size;
         ctrl_transfer[1].rx_buf = (unsigned long)rx_buf;
         int status = ioctl(spi_fd, SPI_IOC_MESSAGE(2), ctrl_transfer);
 
@@ -488,11 +1243,10 @@ int main(int argc, char** argv) {
         }
 
         debug("rx: %2x %2x %2x %2x %2x\n", rx_buf[0], rx_buf[1], rx_buf[2], rx_buf[3], rx_buf[4]);
-        if (write(sync_fd, "1", 1) < 0) {
-            fatal("GPIO write: %s", strerror(errno));
-        }
+        sync_write(1);
 
-        if (rx_buf[0] != 0xCA) {
+        int in_size[N_CHANNEL];
+        if (!parse_header(rx_buf, in_size)) {
             error("Invalid command reply: %2x %2x %2x %2x %2x\n", rx_buf[0], rx_buf[1], rx_buf[2], rx_buf[3], rx_buf[4]);
             retries++;
 
@@ -513,38 +1267,8 @@ int main(int argc, char** argv) {
         // Prepare the data transfer
         struct spi_ioc_transfer transfer[N_CHANNEL * 2];
         memset(transfer, 0, sizeof(transfer));
-        int desc = 0;
-
-        for (int chan=0; chan<N_CHANNEL; chan++) {
-            int size = channels[chan].out_length;
-            // If the coprocessor is ready to receive, and we have data to send
-            if (rx_buf[1] & (1<<chan) && size > 0) {
-                debug("coprocessor is ready to receive and we have %d bytes from channel %d", size, chan);
-                // Make this channel readable by others
-                CONN_POLL(chan).events |= POLLIN;
-                // Set the length to the size we need to send
-                transfer[desc].len = size;
-                // Point the output buffer to the correct place
-                transfer[desc].tx_buf = (unsigned long) &channels[chan].out_buf[0];
-                // Note that we will have no more data to send (once this is sent)
-                channels[chan].out_length = 0;
-                // Mark that we need to make a SPI transaction
-                desc++;
-            }
-
-            // The number of bytes the coprocessor wants to send to a channel
-            size = rx_buf[2+chan];
-            // Check that the channel is writable and there is data that needs to be received
-            if (get_channel_bitmask_state(&channels_writable_bitmask, chan) && size > 0) {
-                debug("Channel %d is ready to have %d bytes written to it from bridge", chan, size);
-                // Set the appropriate size
-                transfer[desc].len = size;
-                // Point our receive buffer to the in buf of the appropriate channel
-                transfer[desc].rx_buf = (unsigned long) &channels[chan].in_buf[0];
-                // Mark that we need a SPI transaction to take place
-                desc++;
-            }
-        }
+        int desc = prepare_data_transfer(transfer, rx_buf[1], writable, in_size,
+            is_full_duplex(tx_buf, rx_buf));
 
         // If the previous logic designated the need for a SPI transaction
         if (desc != 0) {
@@ -559,25 +1283,7 @@ int main(int argc, char** argv) {
             }
 
             // Write received data to the appropriate socket
-            for (int chan=0; chan<N_CHANNEL; chan++) {
-                // Get the length of the received data for this channel
-                int size = rx_buf[2+chan];
-                // Make sure that channel is writable and we have data to send to it
-                if (get_channel_bitmask_state(&channels_writable_bitmask, chan) && size > 0) {
-                    // Write this data to the pipe
-                    int r = write(CONN_POLL(chan).fd, &channels[chan].in_buf[0], size);
-                    debug("%i: Write %u %i\n", chan, size, r);
-                    // Ensure there were no errors
-                    if (r < 0) {
-                        error("Error in write %i: %s\n", chan, strerror(errno));
-                    }
-
-                    // Mark we want to know when this pipe is writable again
-                    CONN_POLL(chan).events |= POLLOUT;
-                    // Set the state to not writable
-                    set_channel_bitmask_state(&channels_writable_bitmask, chan, false);
-                }
-            }
+            complete_data_transfer(writable, in_size);
         }
     }
 }